@@ -0,0 +1,292 @@
+/*
+ *	Batched stat of many files
+ *
+ *	The stat of many files at once, so that a slow filesystem (NFS, cold
+ *	cache) is limited by its throughput and not by the round-trip of each
+ *	request. On Linux the requests are submitted together to an io_uring;
+ *	when it is not available (old kernel, seccomp), a few threads do them.
+ *
+ *	Copyright (C) 2017-2021 Nicholas Christopoulos.
+ *
+ *	This is free software: you can redistribute it and/or modify it under
+ *	the terms of the GNU General Public License as published by the
+ *	Free Software Foundation, either version 3 of the License, or (at your
+ *	option) any later version.
+ *
+ *	It is distributed in the hope that it will be useful, but WITHOUT ANY
+ *	WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *	for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with it. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * 	Written by Nicholas Christopoulos <nereus@freemail.gr>
+ */
+
+#define _GNU_SOURCE		// struct statx
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "bstat.h"
+
+#if defined(__linux__) && defined(__has_include)
+	#if __has_include(<linux/io_uring.h>)
+		#include <sys/syscall.h>
+		#include <sys/mman.h>
+		#include <sys/sysmacros.h>
+		#include <linux/io_uring.h>
+		// IORING_OP_STATX is in the headers of Linux 5.6, with IORING_FEAT_RW_CUR_POS
+		#if defined(__NR_io_uring_setup) && defined(STATX_BASIC_STATS) && defined(IORING_FEAT_RW_CUR_POS)
+			#define HAVE_IO_URING
+		#endif
+	#endif
+#endif
+
+#define BSTAT_THREADS	16		// the threads of the fallback
+#define BSTAT_MIN		8		// fewer files are stat'ed serially
+
+#ifdef HAVE_IO_URING
+#define RING_ENTRIES	256
+
+enum { RING_NONE, RING_READY, RING_FAILED };
+
+static struct {
+	int		state;			// RING_NONE = not created yet, RING_FAILED = not available
+	int		fd;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void	*sq_ptr, *cq_ptr;
+	size_t	sq_size, cq_size;
+	unsigned entries;
+	struct statx *stx;		// the results of the requests in flight
+	} ring;
+
+// creates the ring; returns false if the kernel does not support it
+static int ring_create()
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	ring.state = RING_FAILED;
+	if ( (ring.fd = (int) syscall(__NR_io_uring_setup, RING_ENTRIES, &p)) < 0 )
+		return 0;
+	ring.sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring.cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring.entries = p.sq_entries;
+	ring.sq_ptr = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+	ring.cq_ptr = mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+	ring.sqes   = (struct io_uring_sqe *) mmap(NULL, ring.entries * sizeof(struct io_uring_sqe),
+					PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+	if ( ring.sq_ptr == MAP_FAILED || ring.cq_ptr == MAP_FAILED || ring.sqes == MAP_FAILED ) {
+		if ( ring.sq_ptr != MAP_FAILED ) munmap(ring.sq_ptr, ring.sq_size);
+		if ( ring.cq_ptr != MAP_FAILED ) munmap(ring.cq_ptr, ring.cq_size);
+		if ( ring.sqes != MAP_FAILED )   munmap(ring.sqes, ring.entries * sizeof(struct io_uring_sqe));
+		close(ring.fd);
+		return 0;
+		}
+	ring.sq_tail  = (unsigned *) ((char *) ring.sq_ptr + p.sq_off.tail);
+	ring.sq_mask  = (unsigned *) ((char *) ring.sq_ptr + p.sq_off.ring_mask);
+	ring.sq_array = (unsigned *) ((char *) ring.sq_ptr + p.sq_off.array);
+	ring.cq_head  = (unsigned *) ((char *) ring.cq_ptr + p.cq_off.head);
+	ring.cq_tail  = (unsigned *) ((char *) ring.cq_ptr + p.cq_off.tail);
+	ring.cq_mask  = (unsigned *) ((char *) ring.cq_ptr + p.cq_off.ring_mask);
+	ring.cqes     = (struct io_uring_cqe *) ((char *) ring.cq_ptr + p.cq_off.cqes);
+	ring.stx = (struct statx *) malloc(sizeof(struct statx) * ring.entries);
+	ring.state = RING_READY;
+	return 1;
+}
+
+// the struct stat of the statx
+static void statx_to_stat(const struct statx *x, struct stat *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->st_dev     = makedev(x->stx_dev_major, x->stx_dev_minor);
+	st->st_ino     = x->stx_ino;
+	st->st_mode    = x->stx_mode;
+	st->st_nlink   = x->stx_nlink;
+	st->st_uid     = x->stx_uid;
+	st->st_gid     = x->stx_gid;
+	st->st_rdev    = makedev(x->stx_rdev_major, x->stx_rdev_minor);
+	st->st_size    = x->stx_size;
+	st->st_blksize = x->stx_blksize;
+	st->st_blocks  = x->stx_blocks;
+	st->st_atim.tv_sec = x->stx_atime.tv_sec;	st->st_atim.tv_nsec = x->stx_atime.tv_nsec;
+	st->st_mtim.tv_sec = x->stx_mtime.tv_sec;	st->st_mtim.tv_nsec = x->stx_mtime.tv_nsec;
+	st->st_ctim.tv_sec = x->stx_ctime.tv_sec;	st->st_ctim.tv_nsec = x->stx_ctime.tv_nsec;
+}
+
+// takes the completions of the ring; returns their number
+static int ring_reap(bstat_t *ents, int *unsupported)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head = *ring.cq_head;
+	int		n, done = 0;
+
+	while ( head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE) ) {
+		cqe = &ring.cqes[head & *ring.cq_mask];
+		n = (int) cqe->user_data;
+		if ( cqe->res == -EINVAL )	// the kernel does not know statx requests
+			*unsupported = 1;
+		else if ( cqe->res < 0 )
+			ents[n].error = -cqe->res;
+		else {
+			ents[n].error = 0;
+			statx_to_stat(&ring.stx[n], &ents[n].st);
+			}
+		head ++;
+		done ++;
+		}
+	__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	return done;
+}
+
+// stats up to ring.entries files with one system call; returns -1 if the
+// ring cannot do it
+static int ring_run(int dirfd, bstat_t *ents, int count)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, i;
+	int		n, done = 0, submitted = 0, failed = 0, unsupported = 0;
+	long	ret;
+
+	tail = *ring.sq_tail;
+	for ( n = 0; n < count; n ++, tail ++ ) {
+		i = tail & *ring.sq_mask;
+		sqe = &ring.sqes[i];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_STATX;
+		sqe->fd = dirfd;
+		sqe->addr = (unsigned long) ents[n].name;
+		sqe->len = STATX_BASIC_STATS;
+		sqe->off = (unsigned long) &ring.stx[n];
+		sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+		sqe->user_data = n;
+		ring.sq_array[i] = i;
+		}
+	__atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+	while ( done < count ) {
+		ret = syscall(__NR_io_uring_enter, ring.fd, count - submitted, count - done, IORING_ENTER_GETEVENTS, NULL, 0);
+		if ( ret < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			failed = 1;
+			break;
+			}
+		submitted += ret;
+		done += ring_reap(ents, &unsupported);
+		}
+
+	// the submitted requests read the names and write in ring.stx until they complete
+	while ( failed && done < submitted ) {
+		ret = syscall(__NR_io_uring_enter, ring.fd, 0, submitted - done, IORING_ENTER_GETEVENTS, NULL, 0);
+		if ( ret < 0 && errno != EINTR ) {
+			// cannot wait for them; the ring, its buffer and the names are left to the kernel
+			for ( n = 0; n < submitted; n ++ )
+				ents[n].busy = 1;
+			ring.state = RING_FAILED;
+			return -1;
+			}
+		done += ring_reap(ents, &unsupported);
+		}
+
+	if ( failed || unsupported ) { // the entries without result are left to the threads
+		bstat_done();
+		ring.state = RING_FAILED;
+		return -1;
+		}
+	return 0;
+}
+#endif
+
+// the fallback; the thread 'k' of 'step' threads stats the entries k, k + step, ...
+typedef struct {
+	int		dirfd;
+	bstat_t	*ents;
+	int		count, first, step;
+	} bstat_job_t;
+
+static void *bstat_worker(void *arg)
+{
+	bstat_job_t *job = (bstat_job_t *) arg;
+	bstat_t	*e;
+
+	for ( int i = job->first; i < job->count; i += job->step ) {
+		e = &job->ents[i];
+		if ( e->error != -1 )	// done by the ring
+			continue;
+		e->error = ( fstatat(job->dirfd, e->name, &e->st, AT_SYMLINK_NOFOLLOW) == 0 ) ? 0 : errno;
+		}
+	return NULL;
+}
+
+/*
+ * stats the files of the entries, the symbolic links are not followed;
+ * the result of each one is in its 'st' and 'error'. returns 0.
+ */
+int bstat_run(int dirfd, bstat_t *ents, int count)
+{
+	bstat_job_t	job[BSTAT_THREADS];
+	pthread_t	tid[BSTAT_THREADS];
+	int			started[BSTAT_THREADS];
+	int			i, threads;
+
+	for ( i = 0; i < count; i ++ ) {
+		ents[i].error = -1;
+		ents[i].busy = 0;
+		}
+#ifdef HAVE_IO_URING
+	if ( ring.state == RING_NONE )
+		ring_create();
+	for ( i = 0; ring.state == RING_READY && i < count; i += ring.entries )
+		if ( ring_run(dirfd, ents + i, ( count - i < (int) ring.entries ) ? count - i : (int) ring.entries) != 0 )
+			break;
+	if ( ring.state == RING_READY )
+		return 0;
+#endif
+
+	if ( count < BSTAT_MIN * 2 )
+		threads = 1;
+	else
+		threads = ( count / BSTAT_MIN < BSTAT_THREADS ) ? count / BSTAT_MIN : BSTAT_THREADS;
+	for ( i = 0; i < threads; i ++ ) {
+		job[i].dirfd = dirfd;
+		job[i].ents  = ents;
+		job[i].count = count;
+		job[i].first = i;
+		job[i].step  = threads;
+		started[i] = ( i > 0 && pthread_create(&tid[i], NULL, bstat_worker, &job[i]) == 0 );
+		}
+	for ( i = 0; i < threads; i ++ ) {
+		if ( started[i] )
+			pthread_join(tid[i], NULL);
+		else
+			bstat_worker(&job[i]);	// this thread, or the thread was not created
+		}
+	return 0;
+}
+
+/*
+ * releases the io_uring
+ */
+void bstat_done()
+{
+#ifdef HAVE_IO_URING
+	if ( ring.state == RING_READY ) {
+		munmap(ring.sq_ptr, ring.sq_size);
+		munmap(ring.cq_ptr, ring.cq_size);
+		munmap(ring.sqes, ring.entries * sizeof(struct io_uring_sqe));
+		close(ring.fd);
+		free(ring.stx);
+		ring.stx = NULL;
+		ring.state = RING_NONE;
+		}
+#endif
+}
@@ -0,0 +1,46 @@
+/*
+ *	Batched stat of many files
+ *
+ *	Copyright (C) 2017-2021 Nicholas Christopoulos.
+ *
+ *	This is free software: you can redistribute it and/or modify it under
+ *	the terms of the GNU General Public License as published by the
+ *	Free Software Foundation, either version 3 of the License, or (at your
+ *	option) any later version.
+ *
+ *	It is distributed in the hope that it will be useful, but WITHOUT ANY
+ *	WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *	for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with it. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * 	Written by Nicholas Christopoulos <nereus@freemail.gr>
+ */
+
+#ifndef NDC_BSTAT_H_
+#define NDC_BSTAT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+typedef struct {
+	const char	*name;		// relative to the dirfd of bstat_run()
+	struct stat	st;
+	int			error;		// 0 = st is set, otherwise errno
+	int			busy;		// the name is still in use by the kernel, it must not be freed
+	} bstat_t;
+
+int		bstat_run(int dirfd, bstat_t *ents, int count);
+void	bstat_done();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
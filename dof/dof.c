@@ -25,11 +25,21 @@
  */
 
 #include <time.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <pwd.h>
 #include "panic.h"
 #include "str.h"
 #include "list.h"
 #include <fnmatch.h>
 #include "file.h"
+#include <fcntl.h>
+#include "jobs.h"
+#include "pwalk.h"
+#include "globset.h"
+#include "rexset.h"
+#include "bstat.h"
+#include "hash.h"
 
 // android termux, missing
 #ifndef LINE_MAX
@@ -52,10 +62,16 @@ static list_t incl_list;	// wc-patterns include list
 static list_t regx_list;	// regex exclude list
 static list_t excl_list;	// wc-patterns exclude list
 static list_t dexc_list;	// wc-patterns exclude directories (recursive -X flag)
+static globset_t *excl_set;	// excl_list compiled
+static globset_t *dexc_set;	// dexc_list compiled
 static list_t dreg_list;	// regex exclude driectories (recursive -G flag)
-list_t *dof_lists[]={&cmds_list,&recp_list,&incl_list,&regx_list,&excl_list,&dexc_list,&dreg_list,NULL};
+static rexset_t *regx_set;	// regx_list compiled in one
+static rexset_t *dreg_set;	// dreg_list compiled in one
+static list_t word_list;	// the command splitted to arguments, if the shell is not needed
+static char *cmds;			// the command template
 
 static int opt_flags;		// global version of execute's flags, too much passing in/out
+static int opt_jobs = 1;	// number of parallel jobs; 0 = one per CPU
 
 // just a small stack to store a few pointers for recursive issues
 static void *stack[0x100];	// the stack storage, ah reminds me CP/M's ORG 100h
@@ -67,21 +83,280 @@ static void **sp = stack;	// stack pointer (top)
 
 static int opt_unquote = 0;	// check single quotes in string
 
+// the directory of the items; the recursive mode does not change the working directory
+static const char *exec_dir;		// its name; NULL = the current directory
+static int exec_dirfd = AT_FDCWD;	// its file descriptor
+static int opt_shell = 0;	// always run the commands with the shell
+static int opt_coproc = 0;	// run the commands in persistent shells
+static int opt_null = 0;	// the stdin items are separated by NUL
+static int opt_walkers = 1;	// threads of the recursive walk; 0 = one per CPU
+static int opt_sorted = 0;	// the parallel walk executes the directories in sorted order
+static int opt_batch = 0;	// maximum number of items of %F; 0 = as many as fit
+static int opt_size_cmp = 0;	// --size: '+' bigger, '-' smaller, '=' equal; 0 = no filter
+static off_t opt_size;
+static const char *opt_size_arg;	// the parameters of --size and --newer, for the recipes
+static const char *opt_newer_arg;
+static int opt_newer_set = 0;	// --newer: modified after opt_newer
+static struct timespec opt_newer;
+static int opt_prefetch = 0;	// --prefetch: stat up to this many items at once; 0 = one by one
+
+// the batch of items of %F
+static int batch_mode;		// the command uses %F
+static list_t batch_list;	// the items of the next batch
+static list_t *batch_items;	// the items while expanding, NULL = no batch, %F is %f
+static size_t batch_size;	// the length of the items
+static size_t batch_limit;	// maximum length of the items in the command line
+static int batch_count;		// number of items
+static int batch_quote;		// quote the items for the shell
+list_t *dof_lists[]={&cmds_list,&recp_list,&incl_list,&regx_list,&excl_list,&dexc_list,&dreg_list,&word_list,&batch_list,NULL};
+
+// --stats: the items and the time of each stage; the clock is read only with --stats
+enum { ST_SELECT, ST_EXCLUDE, ST_FILTER, ST_REGEX, ST_SKIP, ST_EXPAND, ST_EXEC, ST_FINISH, ST_COUNT };
+static struct {
+	const char	*name;
+	unsigned long items, dropped;
+	double		time;
+	} stats[ST_COUNT] = {
+	{ "select" }, { "exclude" }, { "filter" }, { "regex" }, { "skip" }, { "expand" }, { "exec" }, { "finish" } };
+static int opt_stats = 0;
+static const char *stats_json;	// --stats-json FILE
+static double *stats_lat;		// the wall time of each command
+static size_t stats_nlat, stats_alloc;
+static unsigned long stats_failed;
+
+// monotonic clock in seconds
+static double stats_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// the start of a stage; 0 without --stats
+#define stats_begin()	(( opt_stats ) ? stats_now() : 0.0)
+
+// the end of a stage for 'items' items, 'dropped' of them did not pass
+#define stats_end(stage, t0, items, dropped)	\
+	do { if ( opt_stats ) stats_add(stage, t0, items, dropped); } while (0)
+
+static void stats_add(int stage, double t0, int items, int dropped)
+{
+	stats[stage].time += stats_now() - t0;
+	stats[stage].items += items;
+	stats[stage].dropped += dropped;
+}
+
+// a command finished
+static void stats_job(const job_t *job, int code)
+{
+	if ( stats_nlat == stats_alloc ) {
+		stats_alloc = ( stats_alloc ) ? stats_alloc * 2 : 1024;
+		stats_lat = (double *) realloc(stats_lat, sizeof(double) * stats_alloc);
+		}
+	stats_lat[stats_nlat ++] = (double) (job->ended.tv_sec - job->began.tv_sec)
+		+ (double) (job->ended.tv_nsec - job->began.tv_nsec) / 1e9;
+	if ( code )
+		stats_failed ++;
+}
+
+static int stats_cmp(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return ( x < y ) ? -1 : ( x > y );
+}
+
+// the latency of the commands at the percentile 'p' (nearest rank)
+static double stats_pct(double p)
+{
+	size_t	rank;
+
+	if ( stats_nlat == 0 )
+		return 0;
+	rank = (size_t) (p * stats_nlat + 0.999999);
+	return stats_lat[( rank ) ? rank - 1 : 0];
+}
+
+// prints the report; the text to stderr, the JSON to the stats_json file
+void stats_report(double wall)
+{
+	static const double pcts[] = { 0.50, 0.90, 0.99, 1.0 };
+	static const char *pnames[] = { "p50", "p90", "p99", "max" };
+	unsigned long commands = stats[ST_EXEC].items;
+	double	rate = ( wall > 0 ) ? stats[ST_SELECT].items / wall : 0;
+	FILE	*fp;
+	int		i;
+
+	// the walk, the reading of the names and the rest is what is left
+	stats[ST_SELECT].time = wall;
+	for ( i = ST_EXCLUDE; i < ST_COUNT; i ++ )
+		stats[ST_SELECT].time -= stats[i].time;
+	if ( stats[ST_SELECT].time < 0 )
+		stats[ST_SELECT].time = 0;
+	qsort(stats_lat, stats_nlat, sizeof(double), stats_cmp);
+	if ( stats_json == NULL ) {
+		fprintf(stderr, "%-8s %10s %10s %10s %6s\n", "stage", "items", "dropped", "seconds", "%");
+		for ( i = 0; i < ST_COUNT; i ++ )
+			fprintf(stderr, "%-8s %10lu %10lu %10.3f %5.1f%%\n", stats[i].name, stats[i].items, stats[i].dropped,
+				stats[i].time, ( wall > 0 ) ? 100.0 * stats[i].time / wall : 0.0);
+		fprintf(stderr, "total    %10lu items in %.3f seconds, %.0f items/s\n", stats[ST_SELECT].items, wall, rate);
+		fprintf(stderr, "commands %10lu, %lu failed", commands, stats_failed);
+		if ( stats_nlat ) {
+			fprintf(stderr, "; latency");
+			for ( i = 0; i < 4; i ++ )
+				fprintf(stderr, " %s %.3f", pnames[i], stats_pct(pcts[i]));
+			}
+		fprintf(stderr, "\n");
+		return;
+		}
+
+	if ( strcmp(stats_json, "-") == 0 )
+		fp = stdout;
+	else if ( (fp = fopen(stats_json, "w")) == NULL ) {
+		error("--stats-json: %s: %s", stats_json, strerror(errno));
+		return;
+		}
+	fprintf(fp, "{\"wall\":%.6f,\"items\":%lu,\"items_per_sec\":%.1f,\"stages\":{",
+		wall, stats[ST_SELECT].items, rate);
+	for ( i = 0; i < ST_COUNT; i ++ )
+		fprintf(fp, "%s\"%s\":{\"items\":%lu,\"dropped\":%lu,\"seconds\":%.6f}", ( i ) ? "," : "",
+			stats[i].name, stats[i].items, stats[i].dropped, stats[i].time);
+	fprintf(fp, "},\"commands\":%lu,\"failed\":%lu,\"latency\":{", commands, stats_failed);
+	for ( i = 0; i < 4; i ++ )
+		fprintf(fp, "%s\"%s\":%.6f", ( i ) ? "," : "", pnames[i], stats_pct(pcts[i]));
+	fprintf(fp, "}}\n");
+	if ( fp != stdout )
+		fclose(fp);
+}
+
+// the item of a command; its path is split and its file is stat'ed once,
+// when a filter or a variable needs it
+typedef struct {
+	const char	*str;
+	pathparts_t	parts;
+	int			split;		// the parts are set
+	struct stat	st;
+	int			stated;		// 0 = not yet, 1 = st is set, -1 = no such file
+	} item_t;
+
+static item_t *run_item;	// the item of the running template, for the variables
+
+// the item is 'str'
+static void item_init(item_t *it, const char *str)
+{
+	it->str = str;
+	it->split = 0;
+	it->stated = 0;
+}
+
+// returns the name of the item for the logs; in the recursive run, with its directory
+static const char *item_label(item_t *it)
+{
+	static char	*buf;
+	static size_t size;
+	size_t	need;
+
+	if ( exec_dir == NULL )
+		return it->str;
+	need = strlen(exec_dir) + strlen(it->str) + 2;
+	if ( need > size ) {
+		size = need * 2;
+		buf = (char *) realloc(buf, size);
+		}
+	sprintf(buf, "%s/%s", exec_dir, it->str);
+	return buf;
+}
+
+// returns the stat of the item's file, NULL if it is not a file; the
+// symbolic links are not followed
+static const struct stat *item_stat(item_t *it)
+{
+	if ( it->stated == 0 )
+		it->stated = ( fstatat(exec_dirfd, it->str, &it->st, AT_SYMLINK_NOFOLLOW) == 0 ) ? 1 : -1;
+	return ( it->stated > 0 ) ? &it->st : NULL;
+}
+
+// returns the part 'f', 'b', 'd' or 'e' of the item, in place
+static const char *item_part(item_t *it, char part, size_t *len)
+{
+	pathparts_t *pp = &it->parts;
+
+	if ( !it->split ) {
+		path_split(it->str, pp);
+		it->split = 1;
+		}
+	switch ( part ) {
+	case 'b': *len = pp->ext - pp->base; return it->str + pp->base;
+	case 'd': *len = pp->dir; return it->str;
+	case 'e':
+		if ( pp->ext == pp->len )
+			{ *len = 0; return ""; }
+		*len = pp->len - pp->ext - 1;
+		return it->str + pp->ext + 1;
+		}
+	*len = pp->len;
+	return it->str;
+}
+
+// copies the part of the path 'arg' to 'rv'
+static void v_part(const char *arg, char *rv, char part)
+{
+	item_t	it;
+	const char *p;
+	size_t	len;
+
+	item_init(&it, arg);
+	p = item_part(&it, part, &len);
+	memcpy(rv, p, len);
+	rv[len] = '\0';
+}
+
 // variables/functions of '%' expressions
 void	v_copyarg(const char *arg, char *rv, const char *e)	{ strcpy(rv, arg); }
 void	v_gethome(const char *arg, char *rv, const char *e)	{ const char *p = getenv("HOME"); strcpy(rv, (p)? p : ""); }
-void	v_basename(const char *arg, char *rv, const char *e)	{ strcpy(rv, basename(arg)); }
-void	v_dirname(const char *arg, char *rv, const char *e)	{ strcpy(rv, dirname(arg)); }
-void	v_extname(const char *arg, char *rv, const char *e)	{ strcpy(rv, extname(arg)); }
-void	v_getcwd(const char *arg, char *rv, const char *e)	{ getcwd(rv, PATH_MAX); }
+void	v_basename(const char *arg, char *rv, const char *e)	{ v_part(arg, rv, 'b'); }
+void	v_dirname(const char *arg, char *rv, const char *e)	{ v_part(arg, rv, 'd'); }
+void	v_extname(const char *arg, char *rv, const char *e)	{ v_part(arg, rv, 'e'); }
+void	v_getsize(const char *arg, char *rv, const char *e)	{
+	const struct stat *st = item_stat(run_item);
+	if ( st ) sprintf(rv, "%lld", (long long) st->st_size); else rv[0] = '\0';
+	}
+void	v_getmtime(const char *arg, char *rv, const char *e)	{
+	const struct stat *st = item_stat(run_item);
+	if ( st ) sprintf(rv, "%lld", (long long) st->st_mtime); else rv[0] = '\0';
+	}
+void	v_getmode(const char *arg, char *rv, const char *e)	{
+	const struct stat *st = item_stat(run_item);
+	if ( st ) sprintf(rv, "%o", (unsigned) (st->st_mode & 07777)); else rv[0] = '\0';
+	}
+void	v_getinode(const char *arg, char *rv, const char *e)	{
+	const struct stat *st = item_stat(run_item);
+	if ( st ) sprintf(rv, "%llu", (unsigned long long) st->st_ino); else rv[0] = '\0';
+	}
+void	v_getcwd(const char *arg, char *rv, const char *e)	{ if ( exec_dir ) strcpy(rv, exec_dir); else getcwd(rv, PATH_MAX); }
+
+// the clock of %date and %time; the start of the run, or the current time with --clock
+static int opt_clock = 0;
+static time_t run_clock;
+static struct tm *clock_tm()
+{
+	time_t now;
+
+	if ( opt_clock )
+		time(&now);
+	else {
+		if ( run_clock == 0 )
+			time(&run_clock);
+		now = run_clock;
+		}
+	return localtime(&now);
+}
 void	v_getdate(const char *arg, char *rv, const char *e)	{
-	time_t now; time(&now);
-	struct tm *local = localtime(&now);
+	struct tm *local = clock_tm();
 	sprintf(rv, "%d-%02d-%02d", local->tm_year + 1900, local->tm_mon + 1, local->tm_mday);
 	}
 void	v_gettime(const char *arg, char *rv, const char *e)	{
-	time_t now; time(&now);
-	struct tm *local = localtime(&now);
+	struct tm *local = clock_tm();
 	sprintf(rv, "%02d-%02d-%02d", local->tm_hour, local->tm_min, local->tm_sec);
 	}
 void	v_repeat(const char *arg, char *rv, const char *e)	{
@@ -136,32 +411,88 @@ void	v_center(const char *arg, char *rv, const char *e)	{
 		}
 	}
 
+// when the value of a variable changes
+#define VAR_ITEM	0	// for each item
+#define VAR_DIR		1	// for each directory of the recursive run
+#define VAR_RUN		2	// never; it is computed once, when the template is compiled
+#define VAR_CLOCK	3	// per run, or per item with --clock
+#define VAR_FILE	4	// for each item, from the stat of its file
+
 typedef struct {
 	const char *name;
 	void (*func)(const char *, char *, const char *);
 	const char *value;
+	int		scope;
 	const char *desc;
 	} dof_var_t;
 
 dof_var_t dof_vars[] = {
-	{ "f", v_copyarg,  NULL,   "the full string" },
-	{ "b", v_basename, NULL,   "the basename of the file; no directory, no extension" },
-	{ "d", v_dirname,  NULL,   "the directory of the filename" },
-	{ "e", v_extname,  NULL,   "the extension of the filename (without dot)" },
-	{ "h", v_gethome,  NULL,   "the home directory" },
-	{ "home", v_gethome, NULL, "the home directory" },
-	{ "cwd", v_getcwd, NULL,   "the current working directory" },
-	{ "date", v_getdate, NULL, "the current date in the form YYYY-MM-DD" },
-	{ "time", v_gettime, NULL, "the current time in the form HH-MM-SS" },
-	{ "r",  v_repeat, NULL,		"%{r/c/n}\tRepeat 'c', 'n' times" },
-	{ "C",  v_center, NULL,		"%{C/c[lr]/n}\tCenterred on text of 'c' repeated 'n' times. The optionals l and r are prefix and suffix, [] are req in this case" },
-	{ "q",  NULL, "'",         "single quote character (')" },
-	{ "c",  NULL, ":",         "colon character (:)" },
-	{ "dq", NULL, "\"",        "double quote character (\")" },
-	{ "bq", NULL, "`",         "backquote character (`)" },
-	{ NULL, NULL, NULL, NULL } // end-of-list
+	{ "f", v_copyarg,  NULL, VAR_ITEM,   "the full string" },
+	{ "F", v_copyarg,  NULL, VAR_ITEM,   "all the items of the batch (see -n); the modifiers apply to each one" },
+	{ "b", v_basename, NULL, VAR_ITEM,   "the basename of the file; no directory, no extension" },
+	{ "d", v_dirname,  NULL, VAR_ITEM,   "the directory of the filename" },
+	{ "e", v_extname,  NULL, VAR_ITEM,   "the extension of the filename (without dot)" },
+	{ "size", v_getsize, NULL, VAR_FILE, "the size of the file in bytes" },
+	{ "mtime", v_getmtime, NULL, VAR_FILE, "the modification time of the file in seconds since the Epoch" },
+	{ "mode", v_getmode, NULL, VAR_FILE, "the permissions of the file in octal" },
+	{ "inode", v_getinode, NULL, VAR_FILE, "the inode number of the file" },
+	{ "h", v_gethome,  NULL, VAR_RUN,    "the home directory" },
+	{ "home", v_gethome, NULL, VAR_RUN,  "the home directory" },
+	{ "cwd", v_getcwd, NULL, VAR_DIR,    "the current working directory" },
+	{ "date", v_getdate, NULL, VAR_CLOCK, "the date that dof started in the form YYYY-MM-DD (current date with --clock)" },
+	{ "time", v_gettime, NULL, VAR_CLOCK, "the time that dof started in the form HH-MM-SS (current time with --clock)" },
+	{ "r",  v_repeat, NULL, VAR_RUN,		"%{r/c/n}\tRepeat 'c', 'n' times" },
+	{ "C",  v_center, NULL, VAR_ITEM,		"%{C/c[lr]/n}\tCenterred on text of 'c' repeated 'n' times. The optionals l and r are prefix and suffix, [] are req in this case" },
+	{ "q",  NULL, "'",  VAR_RUN,         "single quote character (')" },
+	{ "c",  NULL, ":",  VAR_RUN,         "colon character (:)" },
+	{ "dq", NULL, "\"", VAR_RUN,         "double quote character (\")" },
+	{ "bq", NULL, "`",  VAR_RUN,         "backquote character (`)" },
+	{ NULL, NULL, NULL, 0, NULL } // end-of-list
 };
 
+// modifier of a '%' expression, parsed once
+typedef struct {
+	char	type;			// ':', 'l', 'r', 't', 's'
+	char	how;			// l, r: 'f'irst, 'l'ast, 's'tring or 0 (first)
+	char	a, b;			// the characters of l, r, t
+	char	*str1, *str2;	// l, r: the string; s: the pattern and the replacement
+	regex_t	*re;			// s: the pattern compiled, once
+	int		global;			// s///g
+	} mod_t;
+
+// operation of a compiled template
+typedef struct {
+	size_t	text, len;		// literal text, offset in tmpl_t.text; var = NULL
+	const dof_var_t *var;	// the variable
+	char	*expr;			// the expression, args points into it
+	const char *args;		// the text after the name, r and C read it
+	mod_t	*mods;
+	int		nmods;
+	int		batch;			// %F
+	int		scope;			// VAR_ITEM, VAR_FILE or VAR_DIR
+	char	part;			// %f, %b, %d, %e: the part of the item's path
+	char	*cache;			// VAR_DIR: the value of the directory 'gen'
+	unsigned gen;
+	} op_t;
+
+// compiled template
+typedef struct {
+	char	*text;			// the literal parts
+	size_t	tlen, tsize;
+	op_t	*ops;
+	int		count;
+	int		batch;			// uses %F
+	int		stat;			// uses the stat of the item
+	} tmpl_t;
+
+static tmpl_t *cmds_tmpl;	// cmds compiled
+static const char *opt_target;	// --target: the output of the item, skip the item if it is newer
+static tmpl_t *target_tmpl;	// opt_target compiled
+static unsigned dir_gen;	// changes with the directory of the recursive run
+static int tmpl_quiet;		// the errors of the template are already reported
+static tmpl_t **word_tmpl;	// the words of word_list compiled; NULL = the shell is needed
+static int word_count;
+
 // print out all registered variables 
 void	print_vars()
 {
@@ -169,127 +500,251 @@ void	print_vars()
 		printf("%16s %s\n", dof_vars[i].name, dof_vars[i].desc);
 }
 
-// expand '%' expressions
-char *expand_expr(char *dest, const char *source, const char *data)
+// parses the modifiers 'p' to the operation; returns the end of the modifiers
+const char *parse_mods(op_t *op, const char *p)
 {
-	const char *p = source, *pn;
-	char *d = dest, *tp;
-	char *buf = (char *) malloc(BUFSZ);
-	char name[32], *n;
-	int  i, found;
+	const char *pn;
+	mod_t	m;
 
-	// get variable name
-	for ( n = name; isalnum(*p); *n ++ = *p ++ );
-	*n = '\0';
-
-	// find and copy variable's data
-	for ( i = 0, found = 0; dof_vars[i].name; i ++ ) {
-		if ( strcmp(dof_vars[i].name, name) == 0 ) {
-			if ( dof_vars[i].func )
-				dof_vars[i].func(data, buf, p);
-			else if ( dof_vars[i].value )
-				strcpy(buf, dof_vars[i].value);
-			found ++;
-			break;
-			}
-		}
-
-	if ( found ) {
-		// modifiers
-		while ( *p == ':' ) {
-			p ++;
+	while ( *p == ':' ) {
+		p ++;
+		memset(&m, 0, sizeof(m));
+		m.type = *p;
 
-			switch ( *p ) {
-			case ':':
-				strcat(buf, ":");
-				break;
-			case 'l':	// l[{f|l}]<c> the left part of first|last occurrence of 'c'
-				switch ( p[1] ) {
-				case 'f': tp = strchr (buf, p[2]); p += 3; break;
-				case 'l': tp = strrchr(buf, p[2]); p += 3; break;
-				case 's':
-					tp = strstr (buf, p +2);
-					p = ((pn = strchr(p, ':')) == NULL) ? p + strlen(p) : pn;
-					break;
-				default:  tp = strchr (buf, p[1]); p += 2; }
-				if ( tp ) *tp = '\0';
-				break;
-			case 'r':	// r[{f|l}]<c> the right part of first|last occurrence of 'c'
-				switch ( p[1] ) {
-				case 'f': tp = strchr (buf, p[2]); p += 3; break;
-				case 'l': tp = strrchr(buf, p[2]); p += 3; break;
-				case 's':
-					tp = strstr (buf, p +2);
-					p = ((pn = strchr(p, ':')) == NULL) ? p + strlen(p) : pn;
-					break;
-				default:  tp = strchr (buf, p[1]); p += 2; }
-				if ( tp ) {
-					char *tmp = strdup(tp+1);
-					strcpy(buf, tmp);
-					free(tmp);
-					}
+		switch ( *p ) {
+		case ':':	// appends ':'
+			break;
+		case 'l':	// l[{f|l}]<c> the left part of first|last occurrence of 'c'
+		case 'r':	// r[{f|l}]<c> the right part of first|last occurrence of 'c'
+			switch ( p[1] ) {
+			case 'f': case 'l':
+				if ( p[2] == '\0' ) return p + 2;
+				m.how = p[1]; m.a = p[2]; p += 3;
 				break;
-			case 't':	// t<a><b> replaces all occurrences of 'a' to 'b' (character)
-				strtotr(buf, p[1], p[2]);
-				p += 3;
+			case 's':
+				m.how = 's';
+				m.str1 = strdup(p + 2);
+				p = ((pn = strchr(p, ':')) == NULL) ? p + strlen(p) : pn;
 				break;
-			case 's':	// s/str/str/[g]
-				p ++;
-				if ( *p ) {
-					char mark = *p ++; // first mark
-					int  len = strlen(p);
-					char str1[len], str2[len];
-					for ( tp = str1; *p && *p != mark; *tp ++ = *p ++ );
-					*tp = '\0';
-					if ( *p == mark ) { // middle
-						p ++;
-						for ( tp = str2; *p && *p != mark; *tp ++ = *p ++ );
-						*tp = '\0';
-						if ( *p == mark ) { // final
-							int gflag = 0;
-							p ++;
-							if ( *p == 'g' ) { gflag = 1; p ++; }
-							// now replace str1 on buf with str2
-							if ( gflag )
-								res_replace(str1, buf, str2, 32);
-							else
-								res_replace(str1, buf, str2, 1);
-							}
-						}
+			case '\0':
+				return p + 1;
+			default:  m.a = p[1]; p += 2; }
+			break;
+		case 't':	// t<a><b> replaces all occurrences of 'a' to 'b' (character)
+			if ( p[1] == '\0' || p[2] == '\0' )
+				return p + strlen(p);
+			m.a = p[1]; m.b = p[2];
+			p += 3;
+			break;
+		case 's':	// s/str/str/[g]
+			p ++;
+			if ( *p ) {
+				char mark = *p ++; // first mark
+				int  len = strlen(p);
+				char str1[len + 1], str2[len + 1], *tp;
+				for ( tp = str1; *p && *p != mark; *tp ++ = *p ++ );
+				*tp = '\0';
+				if ( *p != mark )
+					return p;
+				p ++; // middle
+				for ( tp = str2; *p && *p != mark; *tp ++ = *p ++ );
+				*tp = '\0';
+				if ( *p != mark )
+					return p;
+				p ++; // final
+				if ( *p == 'g' ) { m.global = 1; p ++; }
+				m.re = (regex_t *) malloc(sizeof(regex_t));
+				if ( regcomp(m.re, str1, REG_EXTENDED|REG_NEWLINE) ) {
+					if ( !tmpl_quiet )
+						error("Regex error compiling '%s'", str1);
+					free(m.re);
+					return p;
 					}
+				m.str1 = strdup(str1);
+				m.str2 = strdup(str2);
 				break;
 				}
+			return p;
+		default:
+			return p;
+			}
+		op->mods = (mod_t *) realloc(op->mods, sizeof(mod_t) * (op->nmods + 1));
+		op->mods[op->nmods ++] = m;
+		}
+	return p;
+}
+
+// apply the modifiers of the operation to 'buf'
+// the output of tmpl_run(), reused for all the items
+static char		*exp_buf, *exp_scratch, *exp_subst;
+static size_t	exp_size, exp_len, exp_scratch_size, exp_subst_size;
+
+// returns the scratch buffer of the variables with room for the value 'data'
+static char *exp_scratch_for(const char *data)
+{
+	size_t	need = BUFSZ + strlen(data); // the items have no size limit
+
+	if ( need > exp_scratch_size ) {
+		exp_scratch_size = need * 2;
+		exp_scratch = (char *) realloc(exp_scratch, exp_scratch_size);
+		}
+	return exp_scratch;
+}
+
+// apply the modifiers of the operation to the scratch buffer; returns the buffer
+char *modify(const op_t *op)
+{
+	const mod_t *m;
+	char	*buf = exp_scratch, *tp;
+	size_t	size;
+
+	for ( m = op->mods; m < op->mods + op->nmods; m ++ ) {
+		switch ( m->type ) {
+		case ':':
+			strcat(buf, ":");
+			break;
+		case 'l': case 'r':
+			switch ( m->how ) {
+			case 'l': tp = strrchr(buf, m->a); break;
+			case 's': tp = strstr (buf, m->str1); break;
+			default:  tp = strchr (buf, m->a); }
+			if ( tp == NULL )
+				break;
+			if ( m->type == 'l' )
+				*tp = '\0';
+			else
+				memmove(buf, tp + 1, strlen(tp + 1) + 1);
+			break;
+		case 't':
+			strtotr(buf, m->a, m->b);
+			break;
+		case 's': // the result is built in the other buffer, then they are swapped
+			rex_subst(m->re, buf, m->str2, ( m->global ) ? 32 : 1, &exp_subst, &exp_subst_size);
+			tp   = exp_subst;		size = exp_subst_size;
+			exp_subst = buf;		exp_subst_size = exp_scratch_size;
+			exp_scratch = buf = tp;	exp_scratch_size = size;
+			exp_scratch_for(buf);	// room for the next modifiers
+			buf = exp_scratch;
+			break;
 			}
+		}
+	return buf;
+}
 
-		// copy result to dest
-		for ( p = buf; *p; *d ++ = *p ++ );
+// adds an operation to the template
+static op_t *tmpl_op(tmpl_t *t)
+{
+	t->ops = (op_t *) realloc(t->ops, sizeof(op_t) * (t->count + 1));
+	memset(&t->ops[t->count], 0, sizeof(op_t));
+	return &t->ops[t->count ++];
+}
+
+// appends literal text to the template; joined with the previous text operation
+static void tmpl_text(tmpl_t *t, const char *s, size_t len)
+{
+	op_t	*op = ( t->count ) ? &t->ops[t->count - 1] : NULL;
+
+	if ( t->tlen + len + 1 > t->tsize ) {
+		t->tsize = (t->tlen + len + 1) * 2;
+		t->text = (char *) realloc(t->text, t->tsize);
+		}
+	if ( op == NULL || op->var ) {
+		op = tmpl_op(t);
+		op->text = t->tlen;
+		}
+	memcpy(t->text + t->tlen, s, len);
+	t->tlen += len;
+	t->text[t->tlen] = '\0';
+	op->len += len;
+}
+
+// frees the data of the operation
+static void op_free(op_t *op)
+{
+	for ( int i = 0; i < op->nmods; i ++ ) {
+		free(op->mods[i].str1);
+		free(op->mods[i].str2);
+		if ( op->mods[i].re ) {
+			regfree(op->mods[i].re);
+			free(op->mods[i].re);
+			}
 		}
+	free(op->mods);
+	free(op->expr);
+	free(op->cache);
+}
+
+// returns the value of the variable of the operation for 'data', modified
+static char *op_value(const op_t *op, const char *data)
+{
+	char	*buf = exp_scratch_for(data);
+
+	if ( op->var->func )
+		op->var->func(data, buf, op->args);
 	else
-		error("unknown variable '%%%s'", name);
+		strcpy(buf, op->var->value);
+	return modify(op);
+}
+
+// compiles the '%' expression 'expr' (name, arguments, modifiers)
+static void tmpl_expr(tmpl_t *t, const char *expr)
+{
+	const char *p = expr;
+	char	name[32], *value;
+	int		i, n;
+	op_t	op;
 
-	free(buf);
-	return d;
+	// get variable name
+	for ( n = 0; isalnum(*p); p ++ )
+		if ( n < (int) sizeof(name) - 1 )
+			name[n ++] = *p;
+	name[n] = '\0';
+
+	for ( i = 0; dof_vars[i].name; i ++ )
+		if ( strcmp(dof_vars[i].name, name) == 0 )
+			break;
+	if ( dof_vars[i].name == NULL ) {
+		if ( !tmpl_quiet )
+			error("unknown variable '%%%s'", name);
+		return;
+		}
+	memset(&op, 0, sizeof(op));
+	op.var   = &dof_vars[i];
+	op.expr  = strdup(expr);
+	op.args  = op.expr + (p - expr);
+	op.batch = ( strcmp(name, "F") == 0 );
+	parse_mods(&op, op.args);
+	if ( strchr("fbde", name[0]) && name[0] && name[1] == '\0' )
+		op.part = name[0];
+	op.scope = op.var->scope;
+	if ( op.scope == VAR_CLOCK )
+		op.scope = ( opt_clock ) ? VAR_ITEM : VAR_RUN;
+
+	if ( op.scope == VAR_RUN ) { // the value is known, it becomes text
+		value = op_value(&op, "");
+		tmpl_text(t, value, strlen(value));
+		op_free(&op);
+		return;
+		}
+	*tmpl_op(t) = op;
+	t->batch |= op.batch;
+	t->stat  |= ( op.scope == VAR_FILE );
 }
 
-// converts and returns the commands to run with 'system()'
-// the buffer must be freed by the caller
-char *expand(const char *source, const char *data)
+/*
+ * compiles the command template to a list of operations; the template is
+ * parsed once, tmpl_run() just executes the operations for each item.
+ * the variables that do not change during the run are computed here.
+ */
+tmpl_t *tmpl_compile(const char *source)
 {
-	const char *p;
-	char *d, *dest;
-	int inside_sq = 0;
-	int count = 0, maxlen;
-
-	// calculate a maximum length for the returned buffer
-	// well that was good before i add regex find & replace,
-	// so add a BUFSZ for safety, after all it is temporary in heap
-	for ( p = source; p; count ++, p = strchr(p + 1, '%'));
-	maxlen = BUFSZ + strlen(source) + strlen(data) * count + 1;
-
-	// replace strings
-	dest = (char *) malloc(maxlen);
-	d = dest;
-	p = source;
+	tmpl_t	*t = (tmpl_t *) calloc(1, sizeof(tmpl_t));
+	const char *p = source;
+	char	*block, *bp, mark;
+	int		inside_sq = 0;
+
+	block = (char *) malloc(strlen(source) + 1);
+	tmpl_text(t, "", 0);
 	while ( *p ) {
 
 		if ( opt_unquote ) {
@@ -300,8 +755,7 @@ char *expand(const char *source, const char *data)
 					p ++;
 					continue;
 					}
-				*d ++ = *p ++;
-				continue;
+				goto literal;
 				}
 			if ( *p == '\'' ) {
 				inside_sq = 1;
@@ -314,145 +768,1053 @@ char *expand(const char *source, const char *data)
 		if ( *p == '%' ) {
 			p ++;
 			if ( *p == '%' || *p == '\'' || *p == '"' || *p == '\\' ) // few special chars
-				*d ++ = *p ++;
-			else if ( *p == '~' ) { d = expand_expr(d, "h", data); p ++; }
-			else {
-				char *block = (char *) malloc(BUFSZ), *bp;
-				char mark = ' ';
+				goto literal;
+			if ( *p == '~' ) { tmpl_expr(t, "h"); p ++; }
+			else if ( ispunct(*p) ) { // %{form} or %(form) or %/form/
+				mark = *p;
+				if ( mark == '{' )	mark = '}';
+				if ( mark == '(' )	mark = ')';
+				if ( mark == '[' )	mark = ']';
+
+				// copy internal block
+				p ++;
+				for ( bp = block; *p; *bp ++ = *p ++ )
+					if ( *p == mark ) {	p ++; break; }
+				*bp = '\0';
+				tmpl_expr(t, block);
+				}
+			else if ( isalnum(*p) ) {
+				for ( bp = block; isalnum(*p); *bp ++ = *p ++ );
+				if ( *p == ':' ) // modifier follows
+					while ( *p && !isspace(*p) )
+						*bp ++ = *p ++;
+				*bp = '\0';
+				tmpl_expr(t, block);
+				}
+			else { // actually, this is error; but I ll pass..
+				tmpl_text(t, "%", 1);
+				if ( *p )
+					goto literal;
+				}
+			continue;
+			}
 
-				if ( ispunct(*p) ) { // %{form} or %(form) or %/form/
-					mark = *p;
-					if ( mark == '{' )	mark = '}';
-					if ( mark == '(' )	mark = ')';
-					if ( mark == '[' )	mark = ']';
+	literal: // copy
+		tmpl_text(t, p ++, 1);
+		}
+	free(block);
+	return t;
+}
 
-					// copy internal block
-					p ++;
-					for ( bp = block; *p; *bp ++ = *p ++ )
-						if ( *p == mark ) {	p ++; break; }
-					*bp = '\0';
-					d = expand_expr(d, block, data);
-					}
-				else if ( isalnum(*p) ) {
-					for ( bp = block; isalnum(*p); *bp ++ = *p ++ );
-					if ( *p == ':' ) // modifier follows
-						while ( *p && !isspace(*p) )
-							*bp ++ = *p ++;
-					*bp = '\0';
-					d = expand_expr(d, block, data);
-					}
-				else { // actually, this is error; but I ll pass..
-					*d ++ = '%';
-					if ( *p )
-						*d ++ = *p ++;
-					}
-				free(block);
+// frees the template
+void tmpl_free(tmpl_t *t)
+{
+	if ( t == NULL )
+		return;
+	for ( op_t *op = t->ops; op < t->ops + t->count; op ++ )
+		op_free(op);
+	free(t->ops);
+	free(t->text);
+	free(t);
+}
+
+
+// makes room for 'n' more bytes in the output
+static void exp_reserve(size_t n)
+{
+	if ( exp_len + n + 1 > exp_size ) {
+		exp_size = ( exp_size ) ? exp_size * 2 : BUFSZ * 4;
+		if ( exp_len + n + 1 > exp_size )
+			exp_size = exp_len + n + 1;
+		exp_buf = (char *) realloc(exp_buf, exp_size);
+		}
+}
+
+// appends the string to the output, quoted for the shell if 'quote'
+static void exp_append(const char *s, int quote)
+{
+	size_t	len = strlen(s);
+
+	exp_reserve(( quote ) ? len * 4 + 3 : len);
+	if ( quote )
+		exp_len = shell_quote(exp_buf + exp_len, s) - exp_buf;
+	else {
+		memcpy(exp_buf + exp_len, s, len);
+		exp_len += len;
+		}
+}
+
+/*
+ * executes the template for 'data'; the result is appended to the output
+ * buffer and NUL-terminated. returns its offset in the buffer.
+ */
+size_t tmpl_run(const tmpl_t *t, item_t *it)
+{
+	size_t	start = exp_len, len;
+	const char *part;
+	char	*buf;
+
+	run_item = it;
+
+	for ( op_t *op = t->ops; op < t->ops + t->count; op ++ ) {
+		if ( op->var == NULL ) {
+			exp_reserve(op->len);
+			memcpy(exp_buf + exp_len, t->text + op->text, op->len);
+			exp_len += op->len;
+			}
+		else if ( op->batch && batch_items ) {
+			// the items of the batch, each one modified separately
+			for ( list_node_t *cur = batch_items->root; cur; cur = cur->next ) {
+				buf = exp_scratch_for(cur->key);
+				strcpy(buf, cur->key);
+				buf = modify(op);
+				if ( cur != batch_items->root )
+					exp_append(" ", 0);
+				exp_append(buf, batch_quote);
+				}
+			}
+		else if ( op->part ) { // a slice of the item
+			part = item_part(it, op->part, &len);
+			if ( op->nmods ) {
+				buf = exp_scratch_for(it->str);
+				memcpy(buf, part, len);
+				buf[len] = '\0';
+				exp_append(modify(op), 0);
+				}
+			else {
+				exp_reserve(len);
+				memcpy(exp_buf + exp_len, part, len);
+				exp_len += len;
 				}
 			}
-		else // copy
-			*d ++ = *p ++;
+		else if ( op->scope == VAR_DIR ) { // once per directory
+			if ( op->cache == NULL || op->gen != dir_gen ) {
+				free(op->cache);
+				op->cache = strdup(op_value(op, it->str));
+				op->gen = dir_gen;
+				}
+			exp_append(op->cache, 0);
+			}
+		else
+			exp_append(op_value(op, it->str), 0);
 		}
+	exp_reserve(0);
+	exp_buf[exp_len ++] = '\0';
+	return start;
+}
 
-	*d = '\0';	// close string
-	return dest;
+// returns the command line of the template for the item; valid until the next call
+const char *expand(const tmpl_t *t, item_t *it)
+{
+	size_t	start;
+
+	exp_len = 0;
+	start = tmpl_run(t, it);	// it may move the buffer
+	return exp_buf + start;
 }
 
-// wclist callback; append file to the item list
-int fl_append(const char *name)
+// shell's special characters; outside of quotes they need a shell
+#define SHELL_CHARS	"|&;<>()$`\\*?[{}~#!\n"
+
+// shell's keywords and builtins that cannot be executed as programs
+static const char *shell_words[] = {
+	".", "alias", "break", "case", "cd", "command", "continue", "eval", "exec",
+	"exit", "export", "for", "function", "if", "read", "readonly", "return",
+	"set", "shift", "source", "times", "trap", "ulimit", "umask", "unalias",
+	"unset", "until", "wait", "while", NULL };
+
+// splits the command template to words (arguments) without the shell; each
+// word is expanded separately, so the items are passed as they are.
+// returns false if the template requires the shell.
+int split_command(const char *source, list_t *words)
 {
-	if ( opt_flags & (OFL_PLAIN | OFL_DIREC) ) {
-		struct stat st;
-		if ( lstat(name, &st) == 0 ) {
-			if ( opt_flags & OFL_PLAIN )
-				if ( S_ISREG(st.st_mode) )
-					list_append((list_t *) peek(), name);
-			if ( opt_flags & OFL_DIREC )
-				if ( S_ISDIR(st.st_mode) )
-					list_append((list_t *) peek(), name);
+	const char *p = source;
+	char	*word = (char *) malloc(strlen(source) + 1), *w = word;
+	char	quote = 0, mark;
+	int		inword = 0, shell = opt_unquote;
+
+	list_clear(words);
+	while ( *p && !shell ) {
+		if ( *p == '%' ) { // dof expression, copy it as it is
+			*w ++ = *p ++;
+			inword = 1;
+			if ( ispunct(*p) && !strchr("%'\"\\~", *p) ) { // %{form}
+				mark = *p;
+				if ( mark == '{' )	mark = '}';
+				if ( mark == '(' )	mark = ')';
+				if ( mark == '[' )	mark = ']';
+				for ( *w ++ = *p ++; *p; )
+					if ( (*w ++ = *p ++) == mark ) break;
+				}
+			else if ( isalnum(*p) ) {
+				while ( isalnum(*p) )	*w ++ = *p ++;
+				if ( *p == ':' ) // modifiers
+					while ( *p && !isspace(*p) && *p != quote ) *w ++ = *p ++;
+				}
+			else if ( *p )
+				*w ++ = *p ++;
+			}
+		else if ( quote ) {
+			if ( *p == quote )	{ quote = 0; p ++; }
+			else if ( quote == '"' && strchr("$`\\", *p) ) shell = 1;
+			else *w ++ = *p ++;
+			}
+		else if ( *p == '\'' || *p == '"' )	{ quote = *p ++; inword = 1; }
+		else if ( isspace(*p) ) {
+			if ( inword ) {
+				*w = '\0';
+				list_add(words, word);
+				w = word;
+				inword = 0;
+				}
+			p ++;
 			}
+		else if ( strchr(SHELL_CHARS, *p) || (*p == '=' && words->root == NULL) )
+			shell = 1;
+		else { *w ++ = *p ++; inword = 1; }
+		}
+	if ( inword && !shell ) {
+		*w = '\0';
+		list_add(words, word);
+		}
+	free(word);
+
+	if ( quote || words->root == NULL )
+		shell = 1;
+	for ( int i = 0; !shell && shell_words[i]; i ++ )
+		if ( strcmp(words->root->key, shell_words[i]) == 0 )
+			shell = 1;
+	if ( shell )
+		list_clear(words);
+	return !shell;
+}
+
+// executes the words of the command without the shell
+// the words with %F are repeated for each item of the batch
+int spawn_words(item_t *it)
+{
+	static char	**argv;
+	static size_t *offs;
+	static int	alloc;
+	list_t	*batch = batch_items;
+	item_t	bi;
+	int		i, n;
+	double	t0;
+
+	for ( i = n = 0; i < word_count; i ++ )
+		n += ( batch && word_tmpl[i]->batch ) ? batch_count : 1;
+	if ( n + 1 > alloc ) {
+		alloc = n + 1;
+		argv = (char **) realloc(argv, sizeof(char *) * alloc);
+		offs = (size_t *) realloc(offs, sizeof(size_t) * alloc);
 		}
+
+	// all the words in the output buffer, the pointers after it stops growing
+	t0 = stats_begin();
+	exp_len = 0;
+	batch_items = NULL;
+	for ( i = n = 0; i < word_count; i ++ ) {
+		if ( batch && word_tmpl[i]->batch ) {
+			for ( list_node_t *item = batch->root; item; item = item->next ) {
+				item_init(&bi, item->key);
+				offs[n ++] = tmpl_run(word_tmpl[i], &bi);
+				}
+			}
+		else
+			offs[n ++] = tmpl_run(word_tmpl[i], it);
+		}
+	batch_items = batch;
+	for ( i = 0; i < n; i ++ )
+		argv[i] = exp_buf + offs[i];
+	argv[n] = NULL;
+	stats_end(ST_EXPAND, t0, 1, 0);
+	t0 = stats_begin();
+	i = jobs_spawn(argv, item_label(it));
+	stats_end(ST_EXEC, t0, 1, 0);
+	return i;
+}
+
+// displays or executes the command for 'data'
+int run_command(int flags, item_t *it)
+{
+	int		status = 0;
+	const char *cmd;
+	double	t0;
+
+	if ( word_tmpl && (flags & OFL_EXEC) )
+		return spawn_words(it);
+	t0 = stats_begin();
+	cmd = expand(cmds_tmpl, it);
+	stats_end(ST_EXPAND, t0, 1, 0);
+	t0 = stats_begin();
+	if ( (flags & OFL_EXEC) == 0 ) // not execute-option
+		fprintf(stdout, "%s\n", cmd);
+	else
+		status = jobs_exec(cmd, item_label(it));
+	stats_end(ST_EXEC, t0, 1, 0);
+	return status;
+}
+
+// displays or executes the command for the batch of items
+int run_batch(int flags)
+{
+	int		status;
+	item_t	it;
+
+	batch_items = &batch_list;
+	batch_quote = ( word_tmpl == NULL );
+	item_init(&it, batch_list.root->key);
+	status = run_command(flags, &it);
+	batch_items = NULL;
+	list_clear(&batch_list);
+	batch_size = batch_count = 0;
+	return status;
+}
+
+// sets the size limit of the batches, as xargs does
+void batch_init()
+{
+	extern char **environ;
+	long	limit = sysconf(_SC_ARG_MAX);
+
+	if ( limit <= 0 )
+		limit = _POSIX_ARG_MAX;
+	limit -= 2048 + strlen(cmds);
+	for ( char **e = environ; *e; e ++ )
+		limit -= strlen(*e) + 1 + sizeof(char *);
+	if ( limit > 0x20000 - BUFSZ ) // linux: 128kB per argument (sh -c)
+		limit = 0x20000 - BUFSZ;
+	if ( limit < 0x400 )
+		limit = 0x400;
+	batch_limit = limit;
+}
+
+// the state of execute()
+static int exec_status;		// the first error of the commands
+
+// --cache: the commands that succeeded in the previous runs, by the command
+// line and the contents of the item; an append-only file of records
+typedef struct {
+	uint64_t cmd;			// the hash of the command line and its directory
+	uint64_t data;			// the hash of the contents of the item
+	int64_t	code;			// the exit code
+	} cache_rec_t;
+
+static int opt_cache = 0;
+static list_t cache_list;	// the keys (cache_key()) of the succeeded ones
+static int cache_fd = -1;	// the file, for the new records
+static uint64_t cache_dir;	// the hash of the directory of the run
+static unsigned cache_gen;	// the dir_gen of cache_dir
+
+// the key of the record
+static void cache_keystr(char *key, uint64_t cmd, uint64_t data)
+{
+	sprintf(key, "%016llx%016llx", (unsigned long long) cmd, (unsigned long long) data);
+}
+
+// opens the cache file ($XDG_CACHE_HOME/dof/results or ~/.cache/dof/results) and loads it
+int cache_open()
+{
+	char	path[PATH_MAX], key[40];
+	const char *base = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+	cache_rec_t rec;
+	FILE	*fp;
+
+	if ( base && *base )
+		snprintf(path, PATH_MAX, "%s", base);
+	else if ( home )
+		snprintf(path, PATH_MAX, "%s/.cache", home);
 	else
-		list_append((list_t *) peek(), name);
+		{ error("--cache: HOME is not set"); return 1; }
+	mkdir(path, 0700);
+	strncat(path, "/dof", PATH_MAX - strlen(path) - 1);
+	mkdir(path, 0700);
+	strncat(path, "/results", PATH_MAX - strlen(path) - 1);
+
+	list_init_set(&cache_list, LIST_UNIQUE | LIST_ARENA);
+	if ( (fp = fopen(path, "rb")) != NULL ) {
+		while ( fread(&rec, sizeof(rec), 1, fp) == 1 ) { // the last record of a key wins
+			cache_keystr(key, rec.cmd, rec.data);
+			if ( rec.code == 0 )
+				list_add(&cache_list, key);
+			else
+				list_remove(&cache_list, key);
+			}
+		fclose(fp);
+		}
+	if ( (cache_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) < 0 )
+		{ error("--cache: %s: %s", path, strerror(errno)); return 1; }
 	return 0;
 }
 
-// wclist callback; remove file from the item list
-int fl_remove(const char *name)
+// makes the key of the item in 'key'; returns false if the item is not a readable file
+static int cache_key(item_t *it, char *key)
+{
+	char	cwd[PATH_MAX];
+	const char *cmd;
+	uint64_t data;
+
+	if ( hash_file(exec_dirfd, it->str, &data) != 0 )
+		return 0;
+	if ( cache_gen != dir_gen || cache_dir == 0 ) { // the same command line in another directory is another command
+		if ( exec_dir == NULL && getcwd(cwd, PATH_MAX) == NULL )
+			strcpy(cwd, ".");
+		cache_dir = hash64(( exec_dir ) ? exec_dir : cwd, strlen(( exec_dir ) ? exec_dir : cwd), 1);
+		cache_gen = dir_gen;
+		}
+	cmd = expand(cmds_tmpl, it);
+	cache_keystr(key, hash64(cmd, strlen(cmd), cache_dir), data);
+	return 1;
+}
+
+// jobs_ondone() callback; appends the result of the command
+static void cache_done(const job_t *job, int code)
+{
+	cache_rec_t rec;
+	char	buf[17];
+
+	if ( job->tag == NULL || cache_fd < 0 )
+		return;
+	memset(&rec, 0, sizeof(rec));
+	memcpy(buf, job->tag, 16);
+	buf[16] = '\0';
+	rec.cmd  = strtoull(buf, NULL, 16);
+	rec.data = strtoull(job->tag + 16, NULL, 16);
+	rec.code = code;
+	if ( write(cache_fd, &rec, sizeof(rec)) != sizeof(rec) )
+		warning("--cache: %s", strerror(errno));
+}
+
+// --joblog: a line for each finished command; --resume and --resume-failed
+// read it and skip the items of the previous runs
+static const char *opt_joblog;
+static int opt_resume;		// 1 = the logged items, 2 = the succeeded ones
+static FILE *joblog_fp;
+static list_t resume_list;	// the items to skip
+static struct timespec joblog_synced;	// the last fsync()
+
+#define JOBLOG_HEADER	"#start\twall\tcpu\texit\titem"
+
+// writes the item to the log, the tabs, newlines and backslashes escaped
+static void joblog_item(FILE *fp, const char *s)
+{
+	for ( ; *s; s ++ ) {
+		switch ( *s ) {
+		case '\t':	fputs("\\t", fp); break;
+		case '\n':	fputs("\\n", fp); break;
+		case '\\':	fputs("\\\\", fp); break;
+		default:	putc(*s, fp);
+			}
+		}
+}
+
+// the escaped item of the log back to the original, in place
+static char *joblog_unescape(char *s)
+{
+	char	*d = s, *p = s;
+
+	for ( ; *p; p ++ ) {
+		if ( *p == '\\' && p[1] ) {
+			p ++;
+			*d ++ = ( *p == 't' ) ? '\t' : ( *p == 'n' ) ? '\n' : *p;
+			}
+		else
+			*d ++ = *p;
+		}
+	*d = '\0';
+	return s;
+}
+
+// loads the items of the log for --resume and opens it for the new lines
+int joblog_open()
 {
-	list_remove((list_t *) peek(), name);
+	records_t *rd;
+	char	*line, *item, *field[5], *p;
+	int		fd, n;
+
+	list_init_set(&resume_list, LIST_UNIQUE | LIST_ARENA);
+	if ( opt_resume && (fd = open(opt_joblog, O_RDONLY | O_CLOEXEC)) >= 0 ) {
+		rd = records_open(fd);
+		while ( (line = records_next(rd, '\n')) != NULL ) {
+			if ( *line == '#' )
+				continue;
+			field[0] = line;
+			for ( n = 1; n < 5 && (p = strchr(field[n - 1], '\t')) != NULL; n ++ ) {
+				*p = '\0';
+				field[n] = p + 1;
+				}
+			if ( n < 5 )
+				continue;
+			item = joblog_unescape(field[4]);
+			if ( opt_resume == 1 || atoi(field[3]) == 0 ) // the last line of an item wins
+				list_add(&resume_list, item);
+			else
+				list_remove(&resume_list, item);
+			}
+		records_close(rd);
+		close(fd);
+		}
+	if ( (joblog_fp = fopen(opt_joblog, "a")) == NULL )
+		{ error("--joblog: %s: %s", opt_joblog, strerror(errno)); return 1; }
+	if ( ftell(joblog_fp) == 0 )
+		fprintf(joblog_fp, "%s\n", JOBLOG_HEADER);
+	clock_gettime(CLOCK_MONOTONIC, &joblog_synced);
 	return 0;
 }
 
-// execute
-int execute(int flags)
+// the seconds between the two times
+static double ts_diff(const struct timespec *end, const struct timespec *start)
 {
-	char	*cmds;
-	int		ignore = 0, exit_status = 0;
-	list_node_t	*cur, *reptr;
-	struct stat st;
-	char	*cwd = (char *) malloc(PATH_MAX);
-	list_t	*items = list_create();
+	return (double) (end->tv_sec - start->tv_sec) + (double) (end->tv_nsec - start->tv_nsec) / 1e9;
+}
 
-	push(items);
-	getcwd(cwd, PATH_MAX);
-//	printf("DIR: %s\n", cwd);
+// jobs_ondone() part; appends the line of the command, synced once per second
+static void joblog_done(const job_t *job, int code)
+{
+	double	cpu;
+
+	if ( joblog_fp == NULL )
+		return;
+	cpu = job->ru.ru_utime.tv_sec + job->ru.ru_stime.tv_sec
+		+ (job->ru.ru_utime.tv_usec + job->ru.ru_stime.tv_usec) / 1e6;
+	fprintf(joblog_fp, "%lld.%03ld\t%.3f\t%.3f\t%d\t",
+		(long long) job->start.tv_sec, job->start.tv_nsec / 1000000L,
+		ts_diff(&job->ended, &job->began), cpu, code);
+	joblog_item(joblog_fp, job->item);
+	putc('\n', joblog_fp);
+	fflush(joblog_fp);	// dof may be killed
+	if ( job->ended.tv_sec != joblog_synced.tv_sec ) {
+		fsync(fileno(joblog_fp));
+		joblog_synced = job->ended;
+		}
+}
 
-	// select files
-	for ( cur = incl_list.root; cur; cur = cur->next )
-		if ( iswcpat(cur->key) )
-			wclist(cur->key, fl_append);
+// closes the log
+void joblog_close()
+{
+	if ( joblog_fp ) {
+		fflush(joblog_fp);
+		fsync(fileno(joblog_fp));
+		fclose(joblog_fp);
+		joblog_fp = NULL;
+		list_release(&resume_list);
+		}
+}
+
+// --rusage: the resources of each command from wait4(); --top N heaviest
+static const char *opt_rusage;
+static FILE *rusage_fp;
+static int rusage_json;			// the FILE ends in .json
+static unsigned long rusage_count;
+static long rusage_maxrss;		// the peak of all commands, KB
+static double rusage_sumrss;
+typedef struct {
+	double	wall, cpu;
+	long	maxrss;
+	int		code;
+	char	*item;
+	} rusage_top_t;
+static rusage_top_t *rusage_top;	// sorted, the heaviest first
+static int opt_top, rusage_ntop;
+
+// opens the report
+int rusage_open()
+{
+	size_t	len = strlen(opt_rusage);
+
+	rusage_json = ( len > 5 && strcmp(opt_rusage + len - 5, ".json") == 0 );
+	if ( strcmp(opt_rusage, "-") == 0 )
+		rusage_fp = stdout;
+	else if ( (rusage_fp = fopen(opt_rusage, "w")) == NULL )
+		{ error("--rusage: %s: %s", opt_rusage, strerror(errno)); return 1; }
+	if ( rusage_json )
+		fputs("[\n", rusage_fp);
+	else
+		fputs("item,exit,wall,user,sys,maxrss_kb,inblock,oublock,nvcsw,nivcsw\n", rusage_fp);
+	return 0;
+}
+
+// writes the string as a JSON string
+static void json_str(FILE *fp, const char *s)
+{
+	putc('"', fp);
+	for ( ; *s; s ++ ) {
+		if ( *s == '"' || *s == '\\' )
+			fprintf(fp, "\\%c", *s);
+		else if ( (unsigned char) *s < ' ' )
+			fprintf(fp, "\\u%04x", *s);
 		else
-			fl_append(cur->key);
+			putc(*s, fp);
+		}
+	putc('"', fp);
+}
+
+// the item as a CSV field or a JSON string
+static void rusage_item(FILE *fp, const char *s)
+{
+	if ( rusage_json )
+		json_str(fp, s);
+	else if ( strpbrk(s, ",\"\r\n") ) {
+		putc('"', fp);
+		for ( ; *s; s ++ ) {
+			if ( *s == '"' )
+				putc('"', fp);
+			putc(*s, fp);
+			}
+		putc('"', fp);
+		}
+	else
+		fputs(s, fp);
+}
 
-	// exclude files
-	for ( cur = excl_list.root; cur; cur = cur->next )
-		if ( iswcpat(cur->key) )
-			wclist(cur->key, fl_remove);
+// jobs_ondone() part; the line of the report and the --top list
+static void rusage_done(const job_t *job, int code)
+{
+	const struct rusage *ru = &job->ru;
+	double	wall = ts_diff(&job->ended, &job->began);
+	double	user = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6;
+	double	sys  = ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+	const char *item = ( job->item ) ? job->item : "";
+	int		i;
+
+	rusage_count ++;
+	rusage_sumrss += ru->ru_maxrss;
+	if ( ru->ru_maxrss > rusage_maxrss )
+		rusage_maxrss = ru->ru_maxrss;
+
+	if ( rusage_fp ) {
+		if ( rusage_json ) {
+			fprintf(rusage_fp, "%s{\"item\":", ( rusage_count > 1 ) ? ",\n" : "");
+			rusage_item(rusage_fp, item);
+			fprintf(rusage_fp, ",\"exit\":%d,\"wall\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,"
+				"\"inblock\":%ld,\"oublock\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld}",
+				code, wall, user, sys, ru->ru_maxrss, ru->ru_inblock, ru->ru_oublock, ru->ru_nvcsw, ru->ru_nivcsw);
+			}
+		else {
+			rusage_item(rusage_fp, item);
+			fprintf(rusage_fp, ",%d,%.6f,%.6f,%.6f,%ld,%ld,%ld,%ld,%ld\n",
+				code, wall, user, sys, ru->ru_maxrss, ru->ru_inblock, ru->ru_oublock, ru->ru_nvcsw, ru->ru_nivcsw);
+			}
+		}
+
+	// insert it in the top list by wall time
+	if ( opt_top ) {
+		if ( rusage_ntop == opt_top && wall <= rusage_top[opt_top - 1].wall )
+			return;
+		if ( rusage_ntop == opt_top )
+			free(rusage_top[-- rusage_ntop].item);
+		for ( i = rusage_ntop; i > 0 && rusage_top[i - 1].wall < wall; i -- )
+			rusage_top[i] = rusage_top[i - 1];
+		rusage_top[i].wall   = wall;
+		rusage_top[i].cpu    = user + sys;
+		rusage_top[i].maxrss = ru->ru_maxrss;
+		rusage_top[i].code   = code;
+		rusage_top[i].item   = strdup(item);
+		rusage_ntop ++;
+		}
+}
+
+// closes the report and prints the --top list to stderr
+void rusage_close()
+{
+	int		i;
+
+	if ( rusage_fp ) {
+		if ( rusage_json )
+			fputs("\n]\n", rusage_fp);
+		if ( rusage_fp != stdout )
+			fclose(rusage_fp);
 		else
-			fl_remove(cur->key);
+			fflush(stdout);
+		rusage_fp = NULL;
+		}
+	if ( opt_top && rusage_count ) {
+		fprintf(stderr, "%10s %10s %10s %5s  %s\n", "wall", "cpu", "maxrss_kb", "exit", "item");
+		for ( i = 0; i < rusage_ntop; i ++ ) {
+			fprintf(stderr, "%10.3f %10.3f %10ld %5d  %s\n", rusage_top[i].wall, rusage_top[i].cpu,
+				rusage_top[i].maxrss, rusage_top[i].code, rusage_top[i].item);
+			free(rusage_top[i].item);
+			}
+		fprintf(stderr, "%lu commands, maxrss peak %ld KB, mean %.0f KB\n",
+			rusage_count, rusage_maxrss, rusage_sumrss / rusage_count);
+		}
+	free(rusage_top);
+	rusage_top = NULL;
+	rusage_ntop = opt_top = 0;
+}
 
-	// for each item in the list
-	cur  = items->root;
-	cmds = list_to_string(&cmds_list, " ");
-	while ( cur ) {
-		ignore = 0;
+// --trace: the spans of the stages and of the jobs in the trace event format;
+// the stages in the lane 0, each job slot in its own lane
+static const char *opt_trace;
+static FILE *trace_fp;
+static char *trace_buf;			// the events are written in blocks of TRACE_BUFSZ
+static double trace_zero;		// the start of dof, monotonic
+static unsigned long trace_count;
+#define TRACE_BUFSZ	(1 << 20)
 
-		// exclude items by regex
-		reptr = regx_list.root;
-		while ( reptr ) {
-			if ( rex_match((regex_t *) reptr->data, cur->key) ) {
-				ignore ++;
-				break;
-				}
-			reptr = reptr->next;
+// the start of a span; 0 without --trace
+#define trace_begin()	(( trace_fp ) ? stats_now() : 0.0)
+
+// the end of a stage span with an optional argument
+#define trace_end(name, t0, key, val)	\
+	do { if ( trace_fp ) trace_stage(name, t0, key, val); } while (0)
+
+// opens the trace file
+int trace_open(double zero)
+{
+	if ( (trace_fp = fopen(opt_trace, "w")) == NULL )
+		{ error("--trace: %s: %s", opt_trace, strerror(errno)); return 1; }
+	trace_buf = (char *) malloc(TRACE_BUFSZ);
+	setvbuf(trace_fp, trace_buf, _IOFBF, TRACE_BUFSZ);
+	trace_zero = zero;
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", trace_fp);
+	return 0;
+}
+
+// the start of a complete event; the caller adds the args and the '}'
+static void trace_event(const char *name, const char *cat, int lane, double t0, double t1)
+{
+	fprintf(trace_fp, "%s{\"name\":", ( trace_count ++ ) ? ",\n" : "");
+	json_str(trace_fp, name);
+	fprintf(trace_fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+		cat, lane, (t0 - trace_zero) * 1e6, (t1 - t0) * 1e6);
+}
+
+static void trace_stage(const char *name, double t0, const char *key, const char *val)
+{
+	trace_event(name, "stage", 0, t0, stats_now());
+	if ( key ) {
+		fprintf(trace_fp, ",\"args\":{\"%s\":", key);
+		json_str(trace_fp, val);
+		putc('}', trace_fp);
+		}
+	putc('}', trace_fp);
+}
+
+// jobs_ondone() part
+static void trace_done(const job_t *job, int code)
+{
+	trace_event(( job->item ) ? job->item : "", "job", job->slot + 1,
+		(double) job->began.tv_sec + (double) job->began.tv_nsec / 1e9,
+		(double) job->ended.tv_sec + (double) job->ended.tv_nsec / 1e9);
+	fprintf(trace_fp, ",\"args\":{\"exit\":%d}}", code);
+}
+
+// the names of the lanes, closes the file
+void trace_close()
+{
+	int		i, n = jobs_max();
+
+	if ( trace_fp == NULL )
+		return;
+	fprintf(trace_fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"dof\"}}",
+		( trace_count ) ? ",\n" : "");
+	for ( i = 0; i < n; i ++ )
+		fprintf(trace_fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"job %d\"}}",
+			i + 1, i + 1);
+	fputs("\n]}\n", trace_fp);
+	if ( fclose(trace_fp) )
+		error("--trace: %s: %s", opt_trace, strerror(errno));
+	trace_fp = NULL;
+	free(trace_buf);
+}
+
+// jobs_ondone() callback
+static void dof_jobdone(const job_t *job, int code)
+{
+	if ( trace_fp )
+		trace_done(job, code);
+	cache_done(job, code);
+	joblog_done(job, code);
+	if ( opt_rusage || opt_top )
+		rusage_done(job, code);
+	if ( opt_stats )
+		stats_job(job, code);
+}
+
+// returns true if the --target of the item exists and it is not older than the item
+static int fl_uptodate(item_t *it)
+{
+	const struct stat *st = item_stat(it);
+	struct stat src, dst;
+
+	if ( st == NULL )
+		return 0;
+	src = *st;
+	if ( S_ISLNK(src.st_mode) && fstatat(exec_dirfd, it->str, &src, 0) != 0 )
+		return 0;
+	if ( fstatat(exec_dirfd, expand(target_tmpl, it), &dst, 0) != 0 )
+		return 0;
+	if ( dst.st_mtim.tv_sec != src.st_mtim.tv_sec )
+		return ( dst.st_mtim.tv_sec > src.st_mtim.tv_sec );
+	return ( dst.st_mtim.tv_nsec >= src.st_mtim.tv_nsec );
+}
+
+// filters the item and runs its command; returns true to stop
+int fl_exec(item_t *it)
+{
+	int		status = 0, skip;
+	char	key[40];
+	double	t0;
+
+	// exclude items by regex
+	t0 = stats_begin();
+	skip = ( regx_set && rexset_match(regx_set, it->str) );
+	stats_end(ST_REGEX, t0, 1, skip);
+	if ( skip )
+		return 0;
+
+	t0 = stats_begin();
+	// --target, skip it if it is already done
+	skip = ( target_tmpl && fl_uptodate(it) );
+
+	// --resume, skip it if it is in the log
+	if ( !skip && opt_resume && resume_list.count )
+		skip = ( list_find(&resume_list, item_label(it)) != NULL );
+
+	// --cache, skip it if the same command succeeded on the same contents
+	if ( !skip && opt_cache && (opt_flags & OFL_EXEC) && cache_key(it, key) ) {
+		if ( (skip = ( list_find(&cache_list, key) != NULL )) == 0 )
+			jobs_tag(key);
+		}
+	stats_end(ST_SKIP, t0, 1, skip);
+	if ( skip )
+		return 0;
+
+	// execute; the returned status may belong to an earlier job of the pool
+	if ( batch_mode ) {
+		size_t len = strlen(it->str) + 3 + sizeof(char *);
+		if ( batch_count && ((batch_size + len > batch_limit) || (opt_batch && batch_count >= opt_batch)) )
+			status = run_batch(opt_flags);
+		list_add(&batch_list, it->str);
+		batch_size += len;
+		batch_count ++;
+		}
+	else
+		status = run_command(opt_flags, it);
+	jobs_tag(NULL);
+	if ( status && !exec_status )
+		exec_status = status;
+	return ( exec_status && ((opt_flags & OFL_FORCE) == 0) );
+}
+
+// the --size and --newer filters; returns true if the item passes
+static int fl_metadata(item_t *it)
+{
+	const struct stat *st = item_stat(it);
+
+	if ( st == NULL )
+		return 0;
+	switch ( opt_size_cmp ) {
+	case '+': if ( st->st_size <= opt_size ) return 0; break;
+	case '-': if ( st->st_size >= opt_size ) return 0; break;
+	case '=': if ( st->st_size != opt_size ) return 0; break;
+		}
+	if ( opt_newer_set ) {
+		if ( st->st_mtim.tv_sec < opt_newer.tv_sec )
+			return 0;
+		if ( st->st_mtim.tv_sec == opt_newer.tv_sec && st->st_mtim.tv_nsec <= opt_newer.tv_nsec )
+			return 0;
+		}
+	return 1;
+}
+
+// filters the item and executes it if it is new
+// the type (DT_*) of the file is known when it comes from a directory scan
+static int fl_item(item_t *it, int type)
+{
+	list_t	*items = (list_t *) peek();	// NULL = no duplicates
+	const struct stat *st;
+	double	t0 = stats_begin();
+	int		pass = 1;
+
+	if ( opt_flags & (OFL_PLAIN | OFL_DIREC) ) {
+		if ( type == DT_UNKNOWN )
+			type = ( (st = item_stat(it)) != NULL ) ? (int) IFTODT(st->st_mode) : -1;
+		if ( (opt_flags & OFL_PLAIN) && type != DT_REG )
+			pass = 0;
+		if ( (opt_flags & OFL_DIREC) && type != DT_DIR )
+			pass = 0;
+		}
+	if ( pass && (opt_size_cmp || opt_newer_set) && !fl_metadata(it) )
+		pass = 0;
+	if ( pass && items ) {
+		unsigned count = items->count;
+		list_append(items, it->str);	// the set has no duplicates
+		pass = ( items->count > count );
+		}
+	stats_end(ST_FILTER, t0, 1, !pass);
+	return ( pass ) ? fl_exec(it) : 0;
+}
+
+// the items waiting for their stat; they are stat'ed together (--prefetch)
+static bstat_t	*pf_ents;
+static int		*pf_types;
+static int		pf_count;
+
+// stats the waiting items at once and passes them on, in order
+int fl_flush()
+{
+	item_t	it;
+	int		i, stop = 0;
+	double	t0;
+
+	if ( pf_count == 0 )
+		return 0;
+	t0 = ( opt_stats || trace_fp ) ? stats_now() : 0;
+	bstat_run(exec_dirfd, pf_ents, pf_count);
+	stats_end(ST_FILTER, t0, 0, 0);
+	trace_end("stat", t0, NULL, NULL);
+	for ( i = 0; i < pf_count; i ++ ) {
+		if ( !stop ) {
+			item_init(&it, pf_ents[i].name);
+			it.st = pf_ents[i].st;
+			it.stated = ( pf_ents[i].error == 0 ) ? 1 : -1;
+			stop = fl_item(&it, pf_types[i]);
 			}
+		if ( !pf_ents[i].busy )
+			free((char *) pf_ents[i].name);
+		}
+	pf_count = 0;
+	return stop;
+}
+
+// returns true if the filters or the command need the stat of the item
+static int fl_needs_stat(int type)
+{
+	return ( opt_size_cmp || opt_newer_set || target_tmpl
+		|| ((opt_flags & (OFL_PLAIN | OFL_DIREC)) && type == DT_UNKNOWN)
+		|| (cmds_tmpl->stat && !batch_mode) );
+}
 
-		// check file attributes
-		if ( !ignore && (flags & (OFL_PLAIN | OFL_DIREC)) ) { // file attribute check
-			if ( lstat(cur->key, &st) == 0 )
-				ignore = ( (flags & OFL_PLAIN) && (!S_ISREG(st.st_mode)) ) ||
-						 ( (flags & OFL_DIREC) && (!S_ISDIR(st.st_mode)) );
+// wclist_typed callback; filters the file and executes it if it is new
+int fl_append_typed(const char *name, int type)
+{
+	item_t	it;
+	double	t0 = stats_begin();
+	int		skip;
+
+	stats[ST_SELECT].items ++;
+	skip = ( excl_set && globset_match(excl_set, name) );
+	stats_end(ST_EXCLUDE, t0, 1, skip);
+	if ( skip )
+		return 0;
+	if ( opt_prefetch > 1 && (pf_count || fl_needs_stat(type)) ) { // the next ones too, in order
+		if ( pf_ents == NULL ) {
+			pf_ents  = (bstat_t *) malloc(sizeof(bstat_t) * opt_prefetch);
+			pf_types = (int *) malloc(sizeof(int) * opt_prefetch);
 			}
+		pf_ents[pf_count].name = strdup(name);
+		pf_types[pf_count ++] = type;
+		return ( pf_count == opt_prefetch ) ? fl_flush() : 0;
+		}
+	item_init(&it, name);
+	return fl_item(&it, type);
+}
 
-		// execute
-		if ( !ignore && (exit_status == 0) ) {
-			char *command_line = expand(cmds, cur->key);
-			if ( (flags & OFL_EXEC) == 0 ) // not execute-option
-				fprintf(stdout, "%s\n", command_line);
-			else
-				exit_status = system(command_line);
-			free(command_line);
-			if (exit_status && ((flags & OFL_FORCE) == 0)) break;
+// wclist callback; filters the file and executes it if it is new
+int fl_append(const char *name)
+{
+	return fl_append_typed(name, DT_UNKNOWN);
+}
+
+// adds the item or the files of the pattern
+int fl_select(const char *key)
+{
+	if ( iswcpat(key) ) {
+		if ( wclist_typed(exec_dirfd, key, fl_append_typed) != 0 )
+			wclist_at(exec_dir, key, fl_append);
+		}
+	else
+		fl_append(key);
+	fl_flush();
+	return ( exec_status && ((opt_flags & OFL_FORCE) == 0) );
+}
+
+// returns the next item of stdin; one per line, or NUL-separated with -0
+const char *stdin_next()
+{
+	static records_t *rd;
+	const char	*item;
+
+	if ( rd == NULL )
+		rd = records_open(STDIN_FILENO);
+	while ( (item = records_next(rd, (opt_null) ? '\0' : '\n')) != NULL )
+		if ( !isdots(filename(item)) )
+			return item;
+	return NULL;
+}
+
+// adds the items of stdin; these are not patterns
+int fl_select_stdin()
+{
+	const char	*item;
+
+	while ( (item = stdin_next()) != NULL ) {
+		fl_append(item);
+		if ( exec_status && ((opt_flags & OFL_FORCE) == 0) )
+			break;
+		}
+	fl_flush();
+	return ( exec_status && ((opt_flags & OFL_FORCE) == 0) );
+}
+
+// the data of the stdin items that dof_readin() keeps; they are not patterns
+static char literal_mark;
+
+// execute
+//
+// the items are executed while they are selected; the -x patterns are
+// matched against the names. when the patterns may overlap (more than one,
+// or braces) their items are kept in a hashed set and an item that is
+// selected twice runs once; the stdin items are never kept.
+int execute(int flags)
+{
+	int		status, patterns = 0;
+	list_node_t	*cur;
+	list_t	*items = NULL;
+	double	t0;
+
+	for ( cur = incl_list.root; cur; cur = cur->next ) {
+		if ( cur->data == NULL && (patterns ++ || strchr(cur->key, '{')) ) {
+			items = list_create_set(LIST_UNIQUE | LIST_ARENA);
+			break;
 			}
+		}
+	exec_status = 0;
 
-		// next
-		cur = cur->next;
+	// select files; the stdin marker has the FILE in data, the stdin items of -r the literal_mark
+	for ( cur = incl_list.root; cur; cur = cur->next ) {
+		t0 = trace_begin();
+		push(( cur->data ) ? NULL : items);
+		if ( cur->data == (void *) &literal_mark ) {
+			fl_append(cur->key);
+			fl_flush();
+			status = ( exec_status && ((opt_flags & OFL_FORCE) == 0) );
+			}
+		else if ( cur->data )
+			status = fl_select_stdin();
+		else
+			status = fl_select(cur->key);
+		pop();
+		trace_end(( cur->data ) ? "stdin" : "glob", t0, "pattern", cur->key);
+		if ( status )
+			break;
 		}
-	
-	list_destroy(items);
-	pop();
-	free(cwd);
-	return exit_status;
+
+	// the rest of the batch
+	if ( batch_count ) {
+		if ( exec_status && ((flags & OFL_FORCE) == 0) ) {
+			list_clear(&batch_list);
+			batch_size = batch_count = 0;
+			}
+		else if ( (status = run_batch(flags)) && !exec_status )
+			exec_status = status;
+		}
+
+	if ( items )
+		list_destroy(items);
+	return exec_status;
 }
 
 // read_conf() callback
@@ -486,28 +1848,50 @@ Options:\n\
 \t-g\texclude regex patterns; the excluded list always has priority.\n\
 \t-r\trecursive execution of commands into sub-directories (beta).\n\
 \t-X\texclude glob patterns for directories only in recursive mode only; the excluded list always has priority.\n\
+\t-t N\tthreads that read the directories in recursive mode; 0 = one per CPU (default 1).\n\
+\t-o\tkeep the order of the directories with -t; they are executed after the walk.\n\
 \t-f\tforce non-stop; dof stops on error, this option forces dof to ignore errors.\n\
 \t-p\tplain files only; directories, devices, etc are ignored.\n\
 \t-d\tdirectories only; plain files, devices, etc are ignored.\n\
 \t-s fist..last[..step]\tadd sequence of numbers (float or integer).\n\
+\t-j N\trun up to N commands in parallel; 0 = one per CPU (default 1).\n\
+\t-S\talways use the shell; by default simple commands are executed directly.\n\
+\t-c\tpersistent shells; the commands that need the shell run in one shell per job.\n\
+\t-n N\tmaximum number of items of %F per command (default as many as fit).\n\
 \t-l\tprint recipes (/etc/dof.conf, ~/.dof)\n\
+\t--size [+|-]N[kMGT]\n\t\tfiles bigger (+), smaller (-) or exactly N bytes; 1024-based units.\n\
+\t--newer FILE\tfiles modified after FILE.\n\
+\t--target T\tskip the items whose output T (a template, ex: %b.ogg) is newer than the item.\n\
+\t--cache\tskip the items that the same command succeeded on their same contents in a previous run.\n\
+\t--joblog FILE\tappend a line for each finished command: start, wall and cpu time, exit code, item.\n\
+\t--resume\tskip the items that are in the --joblog; --resume-failed runs again the failed ones.\n\
+\t--rusage FILE\twrite the cpu, memory, i/o and context switches of each command in CSV (JSON if FILE ends in .json).\n\
+\t--top N\tprint the N commands with the longest wall time, their cpu and memory at the end.\n\
+\t--trace FILE\twrite the spans of the jobs and of the stages in the trace event format (chrome://tracing, Perfetto).\n\
+\t--stats\tprint the items and the time of each stage and the latency of the commands at the end.\n\
+\t--stats-json FILE\tthe same in JSON; - is the stdout.\n\
+\t--prefetch N\tstat the next N items at once when they need it; for NFS and cold caches.\n\
+\t--clock\t%date and %time are the current time of each command instead of the start of dof.\n\
 \t--<recipe>\n\t\texecute recipe (ex: dof --to-ogg)\n\
-\t-\tread from stdin\n\
+\t-\tread from stdin, one item per line\n\
+\t-0\tthe stdin items are separated by NUL (find -print0)\n\
 \t-h\tthis screen\n\
 \t-v\tversion and program information\n\
 \n\
 Variables (use: dof --vars):\n\
 \t%f\tthe string (if file; the full path name)\n\
+\t%F\tmany items at once, the command runs once per batch (see -n)\n\
 \t%b\tthe basename (no directory, no extension)\n\
 \t%d\tthe directory (without trailing '/')\n\
 \t%e\tthe extension (without '.')\n\
+\t%size\tthe size of the file; also %mtime, %mode, %inode\n\
 \n\
 Modifiers:\n\
 modifiers defined by ':' that follows a variable and modifies the result string. You can have unlimited number of modifiers.\n\
 \tl[{f|l|s}]c\treturns the string until the the first|last occurence of 'c'\n\
 \tr[{f|l|s}]c\treturns the right part of the string from the first|last occurence of 'c'\n\
 \ttab\treplaces all 'a' characters with 'b' character\n\
-\ts/l/r/[g]\tusing regex to find 'l' and replace it with 'r'; the 'g' changes all occurrences of 'l'\n\
+\ts/l/r/[g]\tusing regex to find 'l' and replace it with 'r'; the 'g' changes all occurrences of 'l'; \\1 is the first group\n\
 ";
 
 static const char *verss = "\
@@ -530,6 +1914,7 @@ void dof_init()
 {
 	for ( int i = 0; dof_lists[i]; i ++ )
 		list_init(dof_lists[i]);
+	list_init_set(&batch_list, LIST_ARENA);	// cleared after each batch
 	void dof_done();
 	atexit(dof_done);
 	readconf("dof", conf_parser);
@@ -544,7 +1929,72 @@ void dof_done()
 	for ( cur = dreg_list.root; cur; cur = cur->next )
 		regfree((regex_t *) (cur->data));
 	for ( int i = 0; dof_lists[i]; i ++ )
-		list_clear(dof_lists[i]);
+		list_release(dof_lists[i]);
+	rexset_free(regx_set);
+	rexset_free(dreg_set);
+	globset_free(excl_set);
+	globset_free(dexc_set);
+	free(cmds);
+	tmpl_free(cmds_tmpl);
+	tmpl_free(target_tmpl);
+	for ( int i = 0; i < word_count; i ++ )
+		tmpl_free(word_tmpl[i]);
+	free(word_tmpl);
+	free(pf_ents);
+	free(pf_types);
+	if ( cache_fd >= 0 ) {
+		list_release(&cache_list);
+		close(cache_fd);
+		}
+	joblog_close();
+	bstat_done();
+}
+
+// the pattern with its leading ~ or ~user expanded in 'buf' (BUFSZ), as glob() with GLOB_TILDE
+static const char *dof_tilde(const char *pat, char *buf)
+{
+	const char	*home = NULL, *rest;
+	struct passwd *pw;
+	char	user[256];
+	size_t	len;
+
+	if ( pat[0] != '~' )
+		return pat;
+	rest = pat + 1 + strcspn(pat + 1, "/");
+	len = rest - pat - 1;
+	if ( len == 0 ) {
+		if ( (home = getenv("HOME")) == NULL && (pw = getpwuid(getuid())) != NULL )
+			home = pw->pw_dir;
+		}
+	else if ( len < sizeof(user) ) {
+		memcpy(user, pat + 1, len);
+		user[len] = '\0';
+		if ( (pw = getpwnam(user)) != NULL )
+			home = pw->pw_dir;
+		}
+	if ( home == NULL || snprintf(buf, BUFSZ, "%s%s", home, rest) >= BUFSZ )
+		return pat;	// unknown user, as glob()
+	return buf;
+}
+
+// compile the wildcard exclusion lists
+void dof_build_globsets()
+{
+	list_node_t	*cur;
+	char	buf[BUFSZ];
+
+	if ( excl_list.root ) {
+		excl_set = globset_create(GLOBSET_PATHNAME | GLOBSET_BRACE);	// as glob()
+		for ( cur = excl_list.root; cur; cur = cur->next )
+			globset_add(excl_set, dof_tilde(cur->key, buf));
+		globset_compile(excl_set);
+		}
+	if ( dexc_list.root ) {
+		dexc_set = globset_create(0);	// as fnmatch()
+		for ( cur = dexc_list.root; cur; cur = cur->next )
+			globset_add(dexc_set, cur->key);
+		globset_compile(dexc_set);
+		}
 }
 
 // build regex_t table
@@ -555,6 +2005,8 @@ void dof_build_regex()
 	char message[BUFSZ];
 
 	cur = regx_list.root;
+	if ( cur )
+		regx_set = rexset_create();
 	while ( cur ) {
 		cur->data = (void *) malloc(sizeof(regex_t));
 		status = regcomp((regex_t *) (cur->data), cur->key, REG_EXTENDED|REG_NEWLINE|REG_NOSUB);
@@ -562,10 +2014,13 @@ void dof_build_regex()
 			regerror(status, (regex_t *) (cur->data), message, BUFSZ);
 			panic("Regex error compiling '%s': %s\n", cur->key, message);
 			}
+		rexset_add(regx_set, cur->key, (regex_t *) cur->data);
 		cur = cur->next;
 		}
 
 	cur = dreg_list.root;
+	if ( cur )
+		dreg_set = rexset_create();
 	while ( cur ) {
 		cur->data = (void *) malloc(sizeof(regex_t));
 		status = regcomp((regex_t *) (cur->data), cur->key, REG_EXTENDED|REG_NEWLINE|REG_NOSUB);
@@ -573,30 +2028,75 @@ void dof_build_regex()
 			regerror(status, (regex_t *) (cur->data), message, BUFSZ);
 			panic("Regex error compiling '%s': %s\n", cur->key, message);
 			}
+		rexset_add(dreg_set, cur->key, (regex_t *) cur->data);
 		cur = cur->next;
 		}
 }
 
-// execute recipe
+// appends the formatted text to the options of the recipe; 1 if it does not fit
+static int recipe_opt(char *buf, size_t size, const char *fmt, ...)
+{
+	size_t	len = strlen(buf);
+	va_list	ap;
+	int		n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf + len, size - len, fmt, ap);
+	va_end(ap);
+	return ( n < 0 || (size_t) n >= size - len );
+}
+
+// appends the option with its parameter quoted for the shell; 1 if it does not fit
+static int recipe_optarg(char *buf, size_t size, const char *opt, const char *param)
+{
+	if ( recipe_opt(buf, size, "%s '", opt) )
+		return 1;
+	for ( ; *param; param ++ ) {
+		if ( ( *param == '\'' ) ? recipe_opt(buf, size, "'\\''") : recipe_opt(buf, size, "%c", *param) )
+			return 1;
+		}
+	return recipe_opt(buf, size, "' ");
+}
+
+// execute recipe; the options before it are passed to it
 int execute_recipe(const char *key, int flags)
 {
 	list_node_t	*cur;
-
-	cur = recp_list.root;
-	while ( cur ) {
-		if ( strcmp(cur->key, key) == 0 ) {
-			char cmd[BUFSZ];
-			char opt[32];
-			opt[0] = '\0';
-			if ( flags & OFL_EXEC   ) strcat(opt, "-e ");
-			if ( flags & OFL_FORCE  ) strcat(opt, "-f ");
-			if ( flags & OFL_PLAIN  ) strcat(opt, "-p ");
-			if ( flags & OFL_DIREC  ) strcat(opt, "-d ");
-			if ( flags & OFL_RECURS ) strcat(opt, "-r ");
-			snprintf(cmd, BUFSZ, "dof %s %s", opt, (char *) cur->data);
-			return system(cmd);
-			}
-		cur = cur->next;
+	char	cmd[BUFSZ], opt[BUFSZ];
+	int		over = 0;
+
+	for ( cur = recp_list.root; cur; cur = cur->next ) {
+		if ( strcmp(cur->key, key) != 0 )
+			continue;
+		opt[0] = '\0';
+		if ( flags & OFL_EXEC   ) over |= recipe_opt(opt, BUFSZ, "-e ");
+		if ( flags & OFL_FORCE  ) over |= recipe_opt(opt, BUFSZ, "-f ");
+		if ( flags & OFL_PLAIN  ) over |= recipe_opt(opt, BUFSZ, "-p ");
+		if ( flags & OFL_DIREC  ) over |= recipe_opt(opt, BUFSZ, "-d ");
+		if ( flags & OFL_RECURS ) over |= recipe_opt(opt, BUFSZ, "-r ");
+		if ( opt_shell ) over |= recipe_opt(opt, BUFSZ, "-S ");
+		if ( opt_coproc ) over |= recipe_opt(opt, BUFSZ, "-c ");
+		if ( opt_null ) over |= recipe_opt(opt, BUFSZ, "-0 ");
+		if ( opt_jobs != 1 ) over |= recipe_opt(opt, BUFSZ, "-j %d ", opt_jobs);
+		if ( opt_walkers != 1 ) over |= recipe_opt(opt, BUFSZ, "-t %d ", opt_walkers);
+		if ( opt_sorted ) over |= recipe_opt(opt, BUFSZ, "-o ");
+		if ( opt_batch ) over |= recipe_opt(opt, BUFSZ, "-n %d ", opt_batch);
+		if ( opt_size_arg ) over |= recipe_optarg(opt, BUFSZ, "--size", opt_size_arg);
+		if ( opt_newer_arg ) over |= recipe_optarg(opt, BUFSZ, "--newer", opt_newer_arg);
+		if ( opt_prefetch ) over |= recipe_opt(opt, BUFSZ, "--prefetch %d ", opt_prefetch);
+		if ( opt_target ) over |= recipe_optarg(opt, BUFSZ, "--target", opt_target);
+		if ( opt_cache ) over |= recipe_opt(opt, BUFSZ, "--cache ");
+		if ( opt_joblog ) over |= recipe_optarg(opt, BUFSZ, "--joblog", opt_joblog);
+		if ( opt_resume ) over |= recipe_opt(opt, BUFSZ, ( opt_resume == 2 ) ? "--resume-failed " : "--resume ");
+		if ( opt_rusage ) over |= recipe_optarg(opt, BUFSZ, "--rusage", opt_rusage);
+		if ( opt_top ) over |= recipe_opt(opt, BUFSZ, "--top %d ", opt_top);
+		if ( opt_trace ) over |= recipe_optarg(opt, BUFSZ, "--trace", opt_trace);
+		if ( stats_json ) over |= recipe_optarg(opt, BUFSZ, "--stats-json", stats_json);
+		else if ( opt_stats ) over |= recipe_opt(opt, BUFSZ, "--stats ");
+		if ( opt_clock ) over |= recipe_opt(opt, BUFSZ, "--clock ");
+		if ( over || snprintf(cmd, BUFSZ, "dof %s%s", opt, (char *) cur->data) >= BUFSZ )
+			{ error("recipe '%s': the command line is too long", key); return 1; }
+		return system(cmd);
 		}
 
 	error("recipe '%s' not found", key);
@@ -619,6 +2119,26 @@ void dof_additem(stage_t stage, const char *data)
 		}
 }
 
+// reads the stdin items now; the recursive execution needs them in each directory
+void dof_readin()
+{
+	list_t	list;
+	list_node_t	*cur;
+	const char	*item;
+
+	list_init(&list);
+	for ( cur = incl_list.root; cur; cur = cur->next ) {
+		if ( cur->data ) {
+			while ( (item = stdin_next()) != NULL )
+				list_add(&list, item)->data = (void *) &literal_mark;
+			}
+		else
+			list_add(&list, cur->key);
+		}
+	list_clear(&incl_list);
+	incl_list = list;
+}
+
 // add sequence of numbers
 int dof_addseq(stage_t stage, const char *src)
 {
@@ -653,46 +2173,207 @@ int dof_addseq(stage_t stage, const char *src)
 	return 0;
 }
 
-//
-int recurs_exec_cb(const char *path, void *pars)
+// sets the --size filter; [+|-]N[c|k|M|G|T], 1024-based units
+int dof_setsize(const char *src)
 {
-	if ( dexc_list.root ) { // exclude directories list
-		for ( list_node_t *cur = dexc_list.root; cur; cur = cur->next )
-			if ( fnmatch(cur->key, path, /*FNM_PATHNAME |*/ FNM_PERIOD ) == 0 )
-				return 0;
+	const char *p = src;
+	char	*end;
+	long long n;
+
+	opt_size_cmp = '=';
+	if ( *p == '+' || *p == '-' )
+		opt_size_cmp = *p ++;
+	if ( !isdigit(*p) )
+		{ error("example: dof --size +100M * do rm %%f"); return 1; }
+	n = strtoll(p, &end, 10);
+	switch ( *end ) {
+	case 'T': case 't': n *= 1024;
+	case 'G': case 'g': n *= 1024;
+	case 'M': case 'm': n *= 1024;
+	case 'K': case 'k': n *= 1024;
+	case 'c': case '\0':
+		break;
+	default:
+		error("--size: unknown unit '%s'", end);
+		return 1;
 		}
-	if ( dreg_list.root ) { // exclude directories list (regex)
-		for ( list_node_t *cur = dreg_list.root; cur; cur = cur->next )
-			if ( rex_match((regex_t *)cur->data, path) )
-				return 0;
+	if ( *end && end[1] )
+		{ error("--size: unknown unit '%s'", end); return 1; }
+	opt_size = (off_t) n;
+	opt_size_arg = src;
+	return 0;
+}
+
+// sets the --newer filter; the items modified after the file
+int dof_setnewer(const char *file)
+{
+	struct stat st;
+
+	if ( stat(file, &st) != 0 )
+		{ error("--newer: %s: %s", file, strerror(errno)); return 1; }
+	opt_newer = st.st_mtim;
+	opt_newer_set = 1;
+	opt_newer_arg = file;
+	return 0;
+}
+
+// returns the parameter of the long option argv[*i] and moves to it; NULL if it is missing
+const char *long_param(int argc, char **argv, int *i)
+{
+	if ( *i + 1 >= argc ) {
+		error("option %s requires a parameter", argv[*i]);
+		return NULL;
 		}
-	return execute(*(int*)pars);
+	return argv[++ *i];
+}
+
+// recursive execution; the first error of a forced run
+static int recurs_status;
+
+// returns true if the directory is excluded; called by the walker threads too
+int recurs_prune_cb(const char *path, void *pars)
+{
+	if ( dexc_set && globset_match(dexc_set, path) ) // exclude directories list
+		return 1;
+	if ( dreg_set && rexset_match(dreg_set, path) ) // exclude directories list (regex)
+		return 1;
+	return 0;
+}
+
+//
+int recurs_exec_cb(const char *path, int dirfd, void *pars)
+{
+	int flags = *(int*)pars, status;
+	double t0 = trace_begin();
+	exec_dir = path;
+	exec_dirfd = dirfd;
+	dir_gen ++;
+	jobs_chdir(path);
+	status = execute(flags);
+	trace_end("dir", t0, "dir", path);
+	exec_dir = NULL;
+	exec_dirfd = AT_FDCWD;
+	jobs_chdir(NULL);
+	if ( status && (flags & OFL_FORCE) ) { // keep walking, remember the error
+		if ( !recurs_status )
+			recurs_status = status;
+		return 0;
+		}
+	return status;
 }
 
 // main()
 int main(int argc, char **argv)
 {
-	int		i, j, flags = 0, opt_seq = 0, status = 0;
+	int		i, j, flags = 0, opt_param = 0, status = 0;
+	const char *param;
 	stage_t	stage = Items;
+	double	t0, stats_start = stats_now();
 
 	dof_init();
 
 	// parsing arguments
 	for ( i = 1; i < argc; i ++ ) {
-		if ( opt_seq ) { // this arg is the parameter of '-s'
-			if ( dof_addseq(stage, argv[i]) )
-				return 1;
-			opt_seq = 0;
+		if ( opt_param ) { // this arg is the parameter of the previous option
+			switch ( opt_param ) {
+			case 's':
+				if ( dof_addseq(stage, argv[i]) )
+					return 1;
+				break;
+			case 'j':
+				if ( !isdigit(argv[i][0]) )
+					{ error("example: dof -j 4"); return 1; }
+				opt_jobs = atoi(argv[i]);
+				break;
+			case 't':
+				if ( !isdigit(argv[i][0]) )
+					{ error("example: dof -r -t 8 '*.c'"); return 1; }
+				opt_walkers = atoi(argv[i]);
+				break;
+			case 'n':
+				if ( !isdigit(argv[i][0]) )
+					{ error("example: dof -n 100 * do rm %%F"); return 1; }
+				opt_batch = atoi(argv[i]);
+				break;
+				}
+			opt_param = 0;
 			}
 		else if ( (argv[i][0] == '-') && (stage != Commands) ) {
 
 			if ( argv[i][1] == '\0' ) {	// one minus, read from stdin
-				char	buf[BUFSZ];
-				while ( fgets(buf, BUFSZ, stdin) )
-					dof_additem(stage, buf);
+				const char *item;
+				if ( stage == Items ) // read it while executing
+					list_add(&incl_list, "-")->data = (void *) stdin;
+				else
+					while ( (item = stdin_next()) != NULL )
+						dof_additem(stage, item);
 				continue; // we finished with this argv
 				}
 
+			if ( argv[i][1] == '-' ) { // -- double minus
+				if ( strcmp(argv[i], "--help") == 0 )    { puts(usage); return 1; }
+				if ( strcmp(argv[i], "--version") == 0 ) { puts(verss); return 1; }
+				if ( strcmp(argv[i], "--vars") == 0 )    { print_vars(); return 1; }
+				if ( strcmp(argv[i], "--clock") == 0 )   { opt_clock = 1; continue; }
+				if ( strcmp(argv[i], "--cache") == 0 )   { opt_cache = 1; continue; }
+				if ( strcmp(argv[i], "--stats") == 0 )   { opt_stats = 1; continue; }
+				if ( strcmp(argv[i], "--stats-json") == 0 ) {
+					if ( (stats_json = long_param(argc, argv, &i)) == NULL )
+						return 1;
+					opt_stats = 1;
+					continue;
+					}
+				if ( strcmp(argv[i], "--resume") == 0 )  { opt_resume = 1; continue; }
+				if ( strcmp(argv[i], "--resume-failed") == 0 ) { opt_resume = 2; continue; }
+				if ( strcmp(argv[i], "--joblog") == 0 ) {
+					if ( (opt_joblog = long_param(argc, argv, &i)) == NULL )
+						return 1;
+					continue;
+					}
+				if ( strcmp(argv[i], "--rusage") == 0 ) {
+					if ( (opt_rusage = long_param(argc, argv, &i)) == NULL )
+						return 1;
+					continue;
+					}
+				if ( strcmp(argv[i], "--trace") == 0 ) {
+					if ( (opt_trace = long_param(argc, argv, &i)) == NULL )
+						return 1;
+					continue;
+					}
+				if ( strcmp(argv[i], "--top") == 0 ) {
+					if ( (param = long_param(argc, argv, &i)) == NULL )
+						return 1;
+					if ( !isdigit(param[0]) )
+						{ error("example: dof -e --top 10 '*.wav' do 'flac %%f'"); return 1; }
+					opt_top = atoi(param);
+					continue;
+					}
+				if ( strcmp(argv[i], "--size") == 0 ) {
+					if ( (param = long_param(argc, argv, &i)) == NULL || dof_setsize(param) )
+						return 1;
+					continue;
+					}
+				if ( strcmp(argv[i], "--prefetch") == 0 ) {
+					if ( (param = long_param(argc, argv, &i)) == NULL )
+						return 1;
+					if ( !isdigit(param[0]) )
+						{ error("example: dof --prefetch 1000 -p - do ls -l %%f"); return 1; }
+					opt_prefetch = atoi(param);
+					continue;
+					}
+				if ( strcmp(argv[i], "--target") == 0 ) {
+					if ( (opt_target = long_param(argc, argv, &i)) == NULL )
+						return 1;
+					continue;
+					}
+				if ( strcmp(argv[i], "--newer") == 0 ) {
+					if ( (param = long_param(argc, argv, &i)) == NULL || dof_setnewer(param) )
+						return 1;
+					continue;
+					}
+				return execute_recipe(argv[i]+2, flags);
+				}
+
 			// check options
 			for ( j = 1; argv[i][j]; j ++ ) {
 				switch ( argv[i][j] ) {
@@ -706,14 +2387,16 @@ int main(int argc, char **argv)
 				case 'x': stage = ExcludeWC; break;
 				case 'X': stage = ExcludeDirWC; break;
 				case 'u': opt_unquote = !opt_unquote; break;
+				case 'S': opt_shell = 1; break;
+				case 'c': opt_coproc = 1; break;
+				case '0': opt_null = 1; break;
 				case 'h': puts(usage); return 1;
 				case 'v': puts(verss); return 1;
-				case 's': opt_seq = 1; break;
-				case '-': // -- double minus
-					if ( strcmp(argv[i], "--help") == 0 )    { puts(usage); return 1; }
-					if ( strcmp(argv[i], "--version") == 0 ) { puts(verss); return 1; }
-					if ( strcmp(argv[i], "--vars") == 0 )    { print_vars(); return 1; }
-					return execute_recipe(argv[i]+2, flags);
+				case 's': opt_param = 's'; break;
+				case 'j': opt_param = 'j'; break;
+				case 'n': opt_param = 'n'; break;
+				case 't': opt_param = 't'; break;
+				case 'o': opt_sorted = 1; break;
 				case 'l': list_print(&recp_list, stdout); return 0;
 				default:
 					error("unknown option [%c]", argv[i][j]);
@@ -733,11 +2416,74 @@ int main(int argc, char **argv)
 		dof_additem(stage, "%f");
 		}
 
+	if ( opt_param )
+		{ error("option [%c] requires a parameter", opt_param); return 1; }
+
 	dof_build_regex();
+	dof_build_globsets();
+	cmds = list_to_string(&cmds_list, " ");
+	cmds_tmpl = tmpl_compile(cmds);
+	if ( opt_target )
+		target_tmpl = tmpl_compile(opt_target);
+	if ( !opt_shell && split_command(cmds, &word_list) ) {
+		list_node_t *cur;
+		for ( cur = word_list.root; cur; cur = cur->next )
+			word_count ++;
+		word_tmpl = (tmpl_t **) malloc(sizeof(tmpl_t *) * word_count);
+		tmpl_quiet = 1;	// the same parts as cmds
+		for ( cur = word_list.root, word_count = 0; cur; cur = cur->next )
+			word_tmpl[word_count ++] = tmpl_compile(cur->key);
+		tmpl_quiet = 0;
+		}
+	if ( (batch_mode = cmds_tmpl->batch) )
+		batch_init();
+	if ( opt_cache ) {
+		if ( batch_mode )
+			{ error("--cache: the commands with %%F run for many items"); return 1; }
+		if ( cache_open() )
+			return 1;
+		}
+	if ( opt_resume && opt_joblog == NULL )
+		{ error("--resume needs the --joblog FILE"); return 1; }
+	if ( opt_joblog && batch_mode )
+		{ error("--joblog: the commands with %%F run for many items"); return 1; }
+	if ( opt_joblog && joblog_open() )
+		return 1;
+	if ( opt_rusage && rusage_open() )
+		return 1;
+	if ( opt_top )
+		rusage_top = (rusage_top_t *) malloc(sizeof(rusage_top_t) * opt_top);
+	if ( opt_trace && trace_open(stats_start) )
+		return 1;
+	if ( opt_cache || opt_joblog || opt_stats || opt_rusage || opt_top || opt_trace )
+		jobs_ondone(dof_jobdone);
 	opt_flags = flags;
-	if ( flags & OFL_RECURS )
-		status = ddwalk(".", recurs_exec_cb, DIRWALK_RECURSIVE, &flags);
+	jobs_init(opt_jobs);
+	if ( opt_coproc && word_list.root == NULL )
+		jobs_coproc(1);
+	if ( flags & OFL_RECURS ) {
+		dof_readin();
+		t0 = trace_begin();
+		if ( opt_walkers == 1 )
+			status = ddwalk(".", recurs_prune_cb, recurs_exec_cb, DIRWALK_RECURSIVE, &flags);
+		else
+			status = pdwalk(".", opt_walkers, recurs_prune_cb, recurs_exec_cb, (opt_sorted) ? PWALK_SORTED : 0, &flags);
+		trace_end("walk", t0, NULL, NULL);
+		if ( status == 0 )
+			status = recurs_status;
+		}
 	else
 		status = execute(flags);
+
+	// wait for the jobs in flight
+	t0 = ( opt_stats || trace_fp ) ? stats_now() : 0;
+	if ( (i = jobs_finish()) && !status )
+		status = i;
+	stats_end(ST_FINISH, t0, 0, 0);
+	trace_end("finish", t0, NULL, NULL);
+	if ( opt_stats )
+		stats_report(stats_now() - stats_start);
+	rusage_close();
+	trace_close();
 	return status;
 }
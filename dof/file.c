@@ -21,7 +21,9 @@
 
 #include <stdio.h>
 #include <glob.h>
-#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include "panic.h"
 #include "str.h"
 #include "file.h"
@@ -31,6 +33,9 @@
 	#define LINE_MAX 4096
 #endif
 
+// the initial buffer of records_t
+#define RECORDS_BUFSZ	0x100000
+
 /*
  * returns true if the "filename" has wildcards
  */
@@ -57,9 +62,20 @@ int iswcpat(const char *filename)
  * wildcard matches
  */
 void wclist(const char *pattern, int (*callback)(const char *))
+{
+	wclist_at(NULL, pattern, callback);
+}
+
+/*
+ * wildcard matches in the directory 'dir' (NULL = current) without changing
+ * the working directory; the names are passed relative to 'dir'
+ */
+void wclist_at(const char *dir, const char *pattern, int (*callback)(const char *))
 {
 	glob_t globbuf;
 	int flags = GLOB_DOOFFS;
+	size_t skip = 0;
+	char *path = NULL;
 	#ifdef GLOB_TILDE
 	flags |= GLOB_TILDE;
 	#endif
@@ -67,69 +83,253 @@ void wclist(const char *pattern, int (*callback)(const char *))
 	flags |= GLOB_BRACE;
 	#endif
 
+	if ( dir && pattern[0] != '/' && pattern[0] != '~' ) {
+		// escape the directory's name, it is not a pattern
+		char *d = path = (char *) malloc(strlen(dir) * 2 + strlen(pattern) + 2);
+		for ( const char *p = dir; *p; *d ++ = *p ++ )
+			if ( strchr("*?[]{}\\~", *p) )
+				*d ++ = '\\';
+		*d ++ = '/';
+		strcpy(d, pattern);
+		pattern = path;
+		skip = strlen(dir) + 1;
+		}
+
 	globbuf.gl_offs = 0;
 	if ( glob(pattern, flags, NULL, &globbuf) == 0 ) {
 		for ( int i = 0; globbuf.gl_pathv[i]; i ++ ) {
 			const char *name = globbuf.gl_pathv[i];
+			if ( skip && strlen(name) > skip )
+				name += skip;
 			if ( isdots(name)   ) continue;
 			if ( callback(name) ) break;
 			}
 		globfree(&globbuf);
 		}
+	free(path);
+}
+
+// adds the pattern to the table, expanding its first {a,b} block
+static void brace_expand(const char *pattern, char ***table, int *count, int *alloc)
+{
+	const char *p, *open = NULL, *close = NULL;
+	int		depth = 0;
+
+	for ( p = pattern; *p && !close; p ++ ) {
+		if ( *p == '\\' && p[1] ) { p ++; continue; }
+		if ( *p == '{' ) {
+			if ( depth ++ == 0 )
+				open = p;
+			}
+		else if ( *p == '}' && depth ) {
+			if ( -- depth == 0 )
+				close = p;
+			}
+		}
+
+	if ( close == NULL ) { // no more braces
+		if ( *count == *alloc ) {
+			*alloc = ( *alloc ) ? *alloc * 2 : 8;
+			*table = (char **) realloc(*table, sizeof(char *) * *alloc);
+			}
+		(*table)[(*count) ++] = strdup(pattern);
+		return;
+		}
+
+	size_t	plen = open - pattern, slen = strlen(close + 1);
+	char	*buf = (char *) malloc(strlen(pattern) + 1);
+	const char *alt = open + 1;
+	for ( p = alt, depth = 0; p <= close; p ++ ) {
+		if ( *p == '\\' && p[1] ) { p ++; continue; }
+		if ( *p == '{' )	depth ++;
+		else if ( *p == '}' && depth )	depth --;
+		else if ( (*p == ',' && depth == 0) || p == close ) {
+			memcpy(buf, pattern, plen);
+			memcpy(buf + plen, alt, p - alt);
+			memcpy(buf + plen + (p - alt), close + 1, slen + 1);
+			brace_expand(buf, table, count, alloc);
+			alt = p + 1;
+			}
+		}
+	free(buf);
 }
 
 /*
- * returns the name of the file without the directory and the extension
+ * expands the {a,b} blocks of the pattern as glob(GLOB_BRACE) does;
+ * returns a new table of new strings, 'count' is the number of them
  */
-const char *basename(const char *source)
+char **wcbraces(const char *pattern, int *count)
+{
+	char	**table = NULL;
+	int		alloc = 0;
+
+	*count = 0;
+	brace_expand(pattern, &table, count, &alloc);
+	return table;
+}
+
+// entry of wclist_typed()
+typedef struct {
+	char	*name;
+	int		type;
+	} wcentry_t;
+
+static int wcentry_cmp(const void *a, const void *b)
 {
-	static char buf[PATH_MAX];
-	char		*b;
-	const char	*p;
-
-	if ( (p = strrchr(source, '/')) != NULL )
-		strcpy(buf, p + 1);
-	else
-		strcpy(buf, source);
-	if ( (b = (char *) strrchr(buf, '.')) != NULL )
-		*b = '\0';
-	return buf;
+	return strcmp((*(const wcentry_t **) a)->name, (*(const wcentry_t **) b)->name);
 }
 
 /*
- * returns the directory of the file without the trailing '/'
+ * wildcard matches of a pattern without directory parts in the directory
+ * 'dirfd'; the directory is read once and the callback gets the d_type of
+ * each name (DT_UNKNOWN if the filesystem does not fill it), so the caller
+ * does not need to stat them. the names come in the order of glob().
+ * returns -1 if the pattern needs glob().
  */
-const char *dirname(const char *source)
+int wclist_typed(int dirfd, const char *pattern, int (*callback)(const char *, int))
 {
-	static char buf[PATH_MAX];
-	const char	*p;
+	struct dirent *entry;
+	wcentry_t *ents = NULL, **match;
+	char	**pats;
+	int		fd, i, j, n, count = 0, alloc = 0, npats = 0, stop = 0;
+	DIR		*dp;
+
+	if ( strchr(pattern, '/') || pattern[0] == '~' )
+		return -1;
+	if ( (fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 )
+		return -1;
+	if ( (dp = fdopendir(fd)) == NULL ) {
+		close(fd);
+		return -1;
+		}
+	while ( (entry = readdir(dp)) != NULL ) {
+		if ( isdots(entry->d_name) ) continue;
+		if ( count == alloc ) {
+			alloc = ( alloc ) ? alloc * 2 : 256;
+			ents = (wcentry_t *) realloc(ents, sizeof(wcentry_t) * alloc);
+			}
+		ents[count].name = strdup(entry->d_name);
+		ents[count ++].type = entry->d_type;
+		}
+	closedir(dp);
 
-	if ( (p = strrchr(source, '/')) != NULL ) {
-		strcpy(buf, source);
-		buf[p - source] = '\0';
+	// as glob(); the braces first, then the sorted matches of each pattern
+	#ifdef GLOB_BRACE
+	pats = wcbraces(pattern, &npats);
+	#else
+	pats = (char **) malloc(sizeof(char *));
+	pats[npats ++] = strdup(pattern);
+	#endif
+	match = (wcentry_t **) malloc(sizeof(wcentry_t *) * (count + 1));
+	for ( i = 0; i < npats; i ++ ) {
+		for ( j = n = 0; !stop && j < count; j ++ )
+			if ( fnmatch(pats[i], ents[j].name, FNM_PERIOD) == 0 )
+				match[n ++] = &ents[j];
+		qsort(match, n, sizeof(wcentry_t *), wcentry_cmp);
+		for ( j = 0; !stop && j < n; j ++ )
+			stop = callback(match[j]->name, match[j]->type);
+		free(pats[i]);
 		}
-	else
-		buf[0] = '\0';
-	return buf;
+	free(pats);
+	free(match);
+	for ( i = 0; i < count; i ++ )
+		free(ents[i].name);
+	free(ents);
+	return 0;
 }
 
 /*
- * returns the extension of the file without the '.'
+ * opens the records reader on the file descriptor 'fd'
  */
-const char *extname(const char *source)
+records_t *records_open(int fd)
 {
-	static char buf[PATH_MAX];
-	const char	*p;
-
-	if ( (p = strrchr(source, '/')) != NULL )
-		strcpy(buf, p + 1);
-	else
-		strcpy(buf, source);
-	if ( (p = strrchr(buf, '.')) != NULL )
-		return p + 1;
-	else
-		buf[0] = '\0';
-	return buf;
+	records_t *r = (records_t *) malloc(sizeof(records_t));
+	r->fd    = fd;
+	r->size  = RECORDS_BUFSZ;
+	r->buf   = (char *) malloc(r->size);
+	r->start = r->end = 0;
+	r->eof   = 0;
+	return r;
+}
+
+/*
+ * returns the next record without the 'delim', or NULL at the end;
+ * the record is stored in the reader's buffer and it is valid until the
+ * next call. the empty records are skipped.
+ */
+char *records_next(records_t *r, int delim)
+{
+	char	*rec, *p;
+	ssize_t	n;
+
+	for ( ;; ) {
+		while ( r->start < r->end ) {
+			rec = r->buf + r->start;
+			if ( (p = memchr(rec, delim, r->end - r->start)) == NULL )
+				break;
+			*p = '\0';
+			r->start = (p - r->buf) + 1;
+			if ( *rec )
+				return rec;
+			}
+		if ( r->eof ) { // the last record without delimiter
+			if ( r->start == r->end )
+				return NULL;
+			rec = r->buf + r->start;
+			r->buf[r->end] = '\0';	// there is always space for this
+			r->start = r->end;
+			return rec;
+			}
+
+		// move the incomplete record to the beginning; grow if it is full
+		if ( r->start ) {
+			memmove(r->buf, r->buf + r->start, r->end - r->start);
+			r->end -= r->start;
+			r->start = 0;
+			}
+		if ( r->end + 1 >= r->size ) {
+			r->size *= 2;
+			r->buf = (char *) realloc(r->buf, r->size);
+			}
+		while ( (n = read(r->fd, r->buf + r->end, r->size - r->end - 1)) < 0 && errno == EINTR );
+		if ( n <= 0 )
+			r->eof = 1;
+		else
+			r->end += n;
+		}
+}
+
+/*
+ * closes the records reader; the file descriptor remains open
+ */
+void records_close(records_t *r)
+{
+	free(r->buf);
+	free(r);
+}
+
+/*
+ * splits the path to directory, name and extension in one pass; the parts
+ * are offsets in the path, nothing is copied.
+ *
+ * the directory is path[0 .. dir) without the trailing '/', the basename is
+ * path[base .. ext) and the extension, without the '.', path[ext + 1 .. len)
+ * if ext < len.
+ */
+void path_split(const char *path, pathparts_t *pp)
+{
+	const char	*p, *slash = NULL, *dot = NULL;
+
+	for ( p = path; *p; p ++ ) {
+		if ( *p == '/' )
+			{ slash = p; dot = NULL; }
+		else if ( *p == '.' )
+			dot = p;
+		}
+	pp->len  = p - path;
+	pp->dir  = ( slash ) ? slash - path : 0;
+	pp->base = ( slash ) ? pp->dir + 1 : 0;
+	pp->ext  = ( dot ) ? dot - path : pp->len;
 }
 
 // return a pointer to filename without the directory
@@ -171,43 +371,87 @@ int	readconf(const char *appname, int (*parser)(char *))
 	return retval;
 }
 
-//
-int ddwalk(const char *path, int (*callback)(const char *, void*), int flags, void *params)
+// walks the directory 'fd' that its name is in 'path' (PATH_MAX buffer)
+static int ddwalk_at(int fd, char *path, int (*prune)(const char *, void*), int (*callback)(const char *, int, void*), int flags, void *params)
 {
 	struct dirent *entry;
+	struct stat st;
 	const char *dname;
 	DIR		*dp;
-	int		status = 0;
+	int		status, subfd, isdir;
+	size_t	len = strlen(path);
 
-	if ( (dp = opendir(path)) == NULL ) {
-		error("%s:%d = [%s]\n", __FILE__, __LINE__, path);
-		perror("opendir");
+	if ( (dp = fdopendir(fd)) == NULL ) {
+		error("%s: %s", path, strerror(errno));
+		close(fd);
 	    return -1;
 		}
 
-	char *cwd = (char *) malloc(PATH_MAX);
-	getcwd(cwd, PATH_MAX);
-	
-	status = callback(cwd, params);
-	
-	while ( (status == 0) && ((entry = readdir(dp)) != NULL) ) {
+	status = callback(path, fd, params);
+
+	while ( (status == 0) && (flags & DIRWALK_RECURSIVE) && ((entry = readdir(dp)) != NULL) ) {
 		dname = entry->d_name;
 		if ( isdots(dname) ) continue;
-		if ( entry->d_type == DT_DIR ) {
-			if ( (flags & DIRWALK_RECURSIVE) && (entry->d_type == DT_DIR) ) { // recursive behavor
-				if ( chdir(dname) == 0 ) {
-					status = ddwalk(".", callback, flags, params);
-					assert(chdir(cwd) == 0);
-					}
-				else
-					warning("cannot change working directory to '%s'", dname);
-				if ( status ) break;
-				}
+		if ( entry->d_type == DT_UNKNOWN ) // the filesystem does not fill it
+			isdir = ( fstatat(fd, dname, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode) );
+		else
+			isdir = ( entry->d_type == DT_DIR );
+		if ( !isdir ) continue;
+
+		if ( len + strlen(dname) + 2 > PATH_MAX ) {
+			warning("%s/%s: path too long", path, dname);
+			continue;
 			}
+		if ( len > 1 )
+			strcat(path, "/");
+		strcat(path, dname);
+		if ( prune && prune(path, params) )
+			;
+		else if ( (subfd = openat(fd, dname, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) < 0 )
+			warning("cannot open directory '%s'", path);
+		else
+			status = ddwalk_at(subfd, path, prune, callback, flags, params);
+		path[len] = '\0';
 		}
 
-	free(cwd);
 	closedir(dp);
 	return status;
 }
 
+/*
+ * walks the directory tree of 'path' without changing the working directory;
+ * the callback gets the absolute name of each directory and its fd. the
+ * directories that 'prune' returns true, and their subdirectories, are skipped.
+ */
+int ddwalk(const char *path, int (*prune)(const char *, void*), int (*callback)(const char *, int, void*), int flags, void *params)
+{
+	char	*buf = (char *) malloc(PATH_MAX);
+	int		fd, status;
+
+	if ( path[0] == '/' )
+		strncpy(buf, path, PATH_MAX - 1);
+	else if ( getcwd(buf, PATH_MAX) == NULL ) {
+		error("getcwd: %s", strerror(errno));
+		free(buf);
+		return -1;
+		}
+	else if ( strcmp(path, ".") != 0 ) {
+		if ( strlen(buf) > 1 )
+			strcat(buf, "/");
+		strncat(buf, path, PATH_MAX - strlen(buf) - 1);
+		}
+	buf[PATH_MAX - 1] = '\0';
+	if ( prune && prune(buf, params) ) {
+		free(buf);
+		return 0;
+		}
+
+	if ( (fd = open(buf, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 ) {
+		error("%s: %s", buf, strerror(errno));
+		free(buf);
+	    return -1;
+		}
+	status = ddwalk_at(fd, buf, prune, callback, flags, params);
+	free(buf);
+	return status;
+}
@@ -35,17 +35,47 @@ extern "C" {
 #include <limits.h>
 #include <dirent.h>
 
+#ifndef IFTODT
+	#define IFTODT(mode)	(((mode) & 0170000) >> 12)
+#endif
+
 #define isdots(s) ((s)[0]=='.' && ((s)[1]=='\0' || ((s)[1]=='.' && (s)[2]=='\0')))
 
 int		iswcpat(const char *filename);
-const char *basename(const char *source);
 const char *filename(const char *source);
-const char *dirname(const char *source);
-const char *extname(const char *source);
+
+// the parts of a path, offsets in it
+typedef struct {
+	size_t	dir;			// length of the directory, without the '/'
+	size_t	base;			// start of the name
+	size_t	ext;			// the '.' of the extension; len if there is none
+	size_t	len;			// length of the path
+	} pathparts_t;
+
+void	path_split(const char *path, pathparts_t *pp);
+
+/*
+ *	records reader; big block reads, the records are returned in place
+ */
+typedef struct {
+	int		fd;
+	char	*buf;			// the buffer
+	size_t	size;			// allocated size
+	size_t	start, end;		// the data not returned yet
+	int		eof;
+	} records_t;
+
+records_t *records_open(int fd);
+char	*records_next(records_t *r, int delim);
+void	records_close(records_t *r);
 
 void	wclist(const char *pattern, int (*callback)(const char *));
+void	wclist_at(const char *dir, const char *pattern, int (*callback)(const char *));
+char	**wcbraces(const char *pattern, int *count);
+int		wclist_typed(int dirfd, const char *pattern, int (*callback)(const char *, int));
 #define DIRWALK_RECURSIVE	0x01
-int		ddwalk(const char *path, int (*callback)(const char *path, void *app_p), int flags, void *params);
+int		ddwalk(const char *path, int (*prune)(const char *path, void *app_p),
+			int (*callback)(const char *path, int dirfd, void *app_p), int flags, void *params);
 int		readconf(const char *appname, int (*parser)(char *));
 
 #ifdef __cplusplus
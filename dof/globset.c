@@ -0,0 +1,316 @@
+/*
+ *	Compiled set of wildcard patterns
+ *
+ *	The patterns are compiled once and a name is tested against all of
+ *	them in one pass: the plain names, the *.ext and the name* patterns
+ *	are hash lookups; the rest are joined into one regular expression.
+ *	The matching works on the names, the filesystem is not used.
+ *
+ *	Copyright (C) 2017-2021 Nicholas Christopoulos.
+ *
+ *	This is free software: you can redistribute it and/or modify it under
+ *	the terms of the GNU General Public License as published by the
+ *	Free Software Foundation, either version 3 of the License, or (at your
+ *	option) any later version.
+ *
+ *	It is distributed in the hope that it will be useful, but WITHOUT ANY
+ *	WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *	for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with it. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * 	Written by Nicholas Christopoulos <nereus@freemail.gr>
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include "file.h"
+#include "globset.h"
+
+/*
+ * creates an empty set
+ */
+globset_t *globset_create(int flags)
+{
+	globset_t *gs = (globset_t *) calloc(1, sizeof(globset_t));
+
+	gs->flags = flags;
+	list_init_set(&gs->literal, LIST_UNIQUE);
+	list_init_set(&gs->suffix, LIST_UNIQUE);
+	list_init_set(&gs->prefix, LIST_UNIQUE);
+	list_init(&gs->wild[0]);
+	list_init(&gs->wild[1]);
+	list_init(&gs->other);
+	return gs;
+}
+
+// adds the length to the table if it is not there
+static void add_length(int **table, int *count, int len)
+{
+	for ( int i = 0; i < *count; i ++ )
+		if ( (*table)[i] == len )
+			return;
+	*table = (int *) realloc(*table, sizeof(int) * (*count + 1));
+	(*table)[(*count) ++] = len;
+}
+
+// returns true if the characters of the string are not wildcards
+static int isliteral(const char *s, size_t len)
+{
+	for ( size_t i = 0; i < len; i ++ )
+		if ( strchr("*?[\\", s[i]) )
+			return 0;
+	return 1;
+}
+
+/*
+ * translates the pattern to an extended regular expression (without the
+ * anchors); returns NULL if it cannot be done.
+ */
+static char *glob_to_regex(const char *pattern, int pathname)
+{
+	char	*buf = (char *) malloc(strlen(pattern) * 6 + 8), *d = buf;
+	const char *p, *e;
+
+	for ( p = pattern; *p; p ++ ) {
+		switch ( *p ) {
+		case '*':
+			d = stpcpy(d, ( pathname ) ? "[^/]*" : ".*");
+			break;
+		case '?':
+			d = stpcpy(d, ( pathname ) ? "[^/]" : ".");
+			break;
+		case '[':
+			// find the end of the bracket expression
+			e = p + 1;
+			if ( *e == '!' || *e == '^' ) e ++;
+			if ( *e == ']' ) e ++;
+			for ( ; *e && *e != ']'; e ++ ) {
+				if ( *e == '\\' ) { // not the same in regex
+					free(buf);
+					return NULL;
+					}
+				if ( *e == '[' && (e[1] == ':' || e[1] == '.' || e[1] == '=') ) {
+					const char *c = strchr(e + 2, e[1]);
+					if ( c && c[1] == ']' )
+						e = c + 1;
+					}
+				}
+			if ( *e == '\0' ) { // no closing bracket, it is literal
+				d = stpcpy(d, "\\[");
+				break;
+				}
+			*d ++ = '[';
+			p ++;
+			if ( *p == '!' || *p == '^' ) {
+				*d ++ = '^';
+				p ++;
+				if ( *p == ']' )
+					*d ++ = *p ++;
+				if ( pathname )
+					*d ++ = '/';
+				}
+			else if ( *p == ']' )
+				*d ++ = *p ++;
+			for ( ; p < e; p ++ )
+				*d ++ = *p;
+			*d ++ = ']';
+			break;
+		case '\\':
+			if ( p[1] )
+				p ++;
+			// fall through
+		default:
+			if ( strchr(".[]()*+?{}|^$\\", *p) )
+				*d ++ = '\\';
+			*d ++ = *p;
+			}
+		}
+	*d = '\0';
+	return buf;
+}
+
+// adds one pattern, the braces are expanded
+static void globset_add1(globset_t *gs, const char *pattern)
+{
+	int		pathname = ( gs->flags & GLOBSET_PATHNAME );
+	size_t	len = strlen(pattern);
+	char	*rx;
+
+	if ( isliteral(pattern, len) ) {
+		list_add(&gs->literal, pattern);
+		return;
+		}
+	if ( pattern[0] == '*' && len > 1 && isliteral(pattern + 1, len - 1)
+			&& !(pathname && strchr(pattern, '/')) ) {
+		list_add(&gs->suffix, pattern + 1);
+		add_length(&gs->slen, &gs->nslen, len - 1);
+		return;
+		}
+	if ( pattern[len - 1] == '*' && len > 1 && isliteral(pattern, len - 1)
+			&& !(pathname && strchr(pattern, '/')) ) {
+		char *lit = strdup(pattern);
+		lit[len - 1] = '\0';
+		list_add(&gs->prefix, lit);
+		add_length(&gs->plen, &gs->nplen, len - 1);
+		free(lit);
+		return;
+		}
+	// FNM_PATHNAME has the leading period rule after each '/'; only fnmatch() does it
+	if ( (pathname && strchr(pattern, '/')) || (rx = glob_to_regex(pattern, pathname)) == NULL ) {
+		list_add(&gs->other, pattern);
+		return;
+		}
+	list_add(&gs->wild[ !strchr("*?[", pattern[0]) ], rx);
+	free(rx);
+}
+
+/*
+ * adds a pattern to the set; globset_compile() must be called after the last one
+ */
+void globset_add(globset_t *gs, const char *pattern)
+{
+	if ( gs->flags & GLOBSET_BRACE ) {
+		int		count;
+		char	**table = wcbraces(pattern, &count);
+		for ( int i = 0; i < count; i ++ ) {
+			globset_add1(gs, table[i]);
+			free(table[i]);
+			}
+		free(table);
+		}
+	else
+		globset_add1(gs, pattern);
+}
+
+/*
+ * joins the patterns that need regex in one
+ */
+void globset_compile(globset_t *gs)
+{
+	list_node_t *cur;
+	size_t	size;
+	char	*src, *d;
+
+	for ( int i = 0; i < 2; i ++ ) {
+		if ( gs->has_re[i] ) {
+			regfree(&gs->re[i]);
+			gs->has_re[i] = 0;
+			}
+		if ( gs->wild[i].root == NULL )
+			continue;
+		for ( size = 8, cur = gs->wild[i].root; cur; cur = cur->next )
+			size += strlen(cur->key) + 3;
+		d = src = (char *) malloc(size);
+		d = stpcpy(d, "^(");
+		for ( cur = gs->wild[i].root; cur; cur = cur->next ) {
+			*d ++ = '(';
+			d = stpcpy(d, cur->key);
+			*d ++ = ')';
+			if ( cur->next )
+				*d ++ = '|';
+			}
+		strcpy(d, ")$");
+		gs->has_re[i] = ( regcomp(&gs->re[i], src, REG_EXTENDED | REG_NOSUB) == 0 );
+		free(src);
+
+		// too big for regcomp(), globset_match() will do them one by one
+		for ( cur = gs->wild[i].root; !gs->has_re[i] && cur; cur = cur->next ) {
+			if ( cur->data )
+				continue;
+			src = (char *) malloc(strlen(cur->key) + 5);
+			sprintf(src, "^(%s)$", cur->key);
+			cur->data = malloc(sizeof(regex_t));
+			if ( regcomp((regex_t *) cur->data, src, REG_EXTENDED | REG_NOSUB) != 0 ) {
+				free(cur->data);
+				cur->data = NULL;
+				}
+			free(src);
+			}
+		}
+}
+
+/*
+ * returns true if the name matches any of the patterns
+ */
+int globset_match(const globset_t *gs, const char *name)
+{
+	int		pathname = ( gs->flags & GLOBSET_PATHNAME );
+	int		fnm = ( pathname ) ? (FNM_PATHNAME | FNM_PERIOD) : FNM_PERIOD;
+	int		dot = ( name[0] == '.' );	// only a literal matches the leading period
+	size_t	len = strlen(name), n;
+	list_node_t *cur;
+
+	if ( gs->literal.root && list_find((list_t *) &gs->literal, name) )
+		return 1;
+
+	for ( int i = 0; !dot && i < gs->nslen; i ++ ) {
+		if ( (n = gs->slen[i]) > len )
+			continue;
+		if ( list_find((list_t *) &gs->suffix, name + len - n)
+				&& !(pathname && memchr(name, '/', len - n)) )
+			return 1;
+		}
+
+	if ( gs->nplen ) {
+		char	key[len + 1];
+		for ( int i = 0; i < gs->nplen; i ++ ) {
+			if ( (n = gs->plen[i]) > len )
+				continue;
+			memcpy(key, name, n);
+			key[n] = '\0';
+			if ( list_find((list_t *) &gs->prefix, key)
+					&& !(pathname && strchr(name + n, '/')) )
+				return 1;
+			}
+		}
+
+	for ( int i = dot; i < 2; i ++ ) {
+		if ( gs->has_re[i] ) {
+			if ( regexec(&gs->re[i], name, 0, NULL, 0) == 0 )
+				return 1;
+			}
+		else {
+			for ( cur = gs->wild[i].root; cur; cur = cur->next )
+				if ( cur->data && regexec((regex_t *) cur->data, name, 0, NULL, 0) == 0 )
+					return 1;
+			}
+		}
+
+	for ( cur = gs->other.root; cur; cur = cur->next )
+		if ( fnmatch(cur->key, name, fnm) == 0 )
+			return 1;
+	return 0;
+}
+
+/*
+ * frees the set
+ */
+void globset_free(globset_t *gs)
+{
+	if ( gs == NULL )
+		return;
+	for ( int i = 0; i < 2; i ++ ) {
+		if ( gs->has_re[i] )
+			regfree(&gs->re[i]);
+		for ( list_node_t *cur = gs->wild[i].root; cur; cur = cur->next ) {
+			if ( cur->data ) {
+				regfree((regex_t *) cur->data);
+				free(cur->data);
+				}
+			}
+		list_clear(&gs->wild[i]);
+		}
+	list_clear(&gs->literal);
+	list_clear(&gs->suffix);
+	list_clear(&gs->prefix);
+	list_clear(&gs->other);
+	free(gs->slen);
+	free(gs->plen);
+	free(gs);
+}
@@ -0,0 +1,58 @@
+/*
+ *	Compiled set of wildcard patterns
+ *
+ *	Copyright (C) 2017-2021 Nicholas Christopoulos.
+ *
+ *	This is free software: you can redistribute it and/or modify it under
+ *	the terms of the GNU General Public License as published by the
+ *	Free Software Foundation, either version 3 of the License, or (at your
+ *	option) any later version.
+ *
+ *	It is distributed in the hope that it will be useful, but WITHOUT ANY
+ *	WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *	for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with it. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * 	Written by Nicholas Christopoulos <nereus@freemail.gr>
+ */
+
+#ifndef NDC_GLOBSET_H_
+#define NDC_GLOBSET_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <regex.h>
+#include "list.h"
+
+#define GLOBSET_PATHNAME	0x01	// the wildcards do not match '/', as glob()
+#define GLOBSET_BRACE		0x02	// expand the {a,b} blocks, as glob()
+
+typedef struct {
+	int		flags;
+	list_t	literal;		// the names
+	list_t	suffix;			// *LIT
+	list_t	prefix;			// LIT*
+	int		*slen, nslen;	// the distinct lengths of the suffixes
+	int		*plen, nplen;	// the distinct lengths of the prefixes
+	list_t	wild[2];		// the rest, translated to regex; [0] starts with wildcard
+	regex_t	re[2];			// all of wild[i] in one regex
+	int		has_re[2];
+	list_t	other;			// the rest of the rest, fnmatch() one by one
+	} globset_t;
+
+globset_t *globset_create(int flags);
+void	globset_add(globset_t *gs, const char *pattern);
+void	globset_compile(globset_t *gs);
+int		globset_match(const globset_t *gs, const char *name);
+void	globset_free(globset_t *gs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ *	Fast hash of memory blocks and files
+ *
+ *	hash64() is the XXH64 of Yann Collet; it reads 32 bytes per round in four
+ *	independent lanes and runs at memory speed. The big files are split in
+ *	chunks that are read with pread() and hashed by threads; the hash of the file is the hash of
+ *	the hashes of the chunks, so it does not depend on the number of threads.
+ *
+ *
+ *	Copyright (C) 2017-2021 Nicholas Christopoulos.
+ *
+ *	This is free software: you can redistribute it and/or modify it under
+ *	the terms of the GNU General Public License as published by the
+ *	Free Software Foundation, either version 3 of the License, or (at your
+ *	option) any later version.
+ *
+ *	It is distributed in the hope that it will be useful, but WITHOUT ANY
+ *	WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *	for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with it. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * 	Written by Nicholas Christopoulos <nereus@freemail.gr>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "hash.h"
+
+#define P1	11400714785074694791ULL
+#define P2	14029467366897019727ULL
+#define P3	1609587929392839161ULL
+#define P4	9650029242287828579ULL
+#define P5	2870177450012600261ULL
+
+#define HASH_CHUNK		(4 << 20)	// the chunks of the big files
+#define HASH_THREADS	8			// the threads for the chunks
+#define HASH_READ		(1 << 16)	// smaller files are read at once
+
+static inline uint64_t rotl64(uint64_t x, int r)	{ return (x << r) | (x >> (64 - r)); }
+static inline uint64_t read64(const uint8_t *p)		{ uint64_t v; memcpy(&v, p, 8); return v; }
+static inline uint32_t read32(const uint8_t *p)		{ uint32_t v; memcpy(&v, p, 4); return v; }
+
+static inline uint64_t xxround(uint64_t acc, uint64_t input)
+{
+	acc += input * P2;
+	acc  = rotl64(acc, 31);
+	return acc * P1;
+}
+
+static inline uint64_t xxmerge(uint64_t acc, uint64_t val)
+{
+	acc ^= xxround(0, val);
+	return acc * P1 + P4;
+}
+
+/*
+ * returns the 64-bit hash of the memory block
+ */
+uint64_t hash64(const void *data, size_t len, uint64_t seed)
+{
+	const uint8_t *p = (const uint8_t *) data, *end = p + len;
+	uint64_t h;
+
+	if ( len >= 32 ) {
+		const uint8_t *limit = end - 32;
+		uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+
+		do {
+			v1 = xxround(v1, read64(p));		p += 8;
+			v2 = xxround(v2, read64(p));		p += 8;
+			v3 = xxround(v3, read64(p));		p += 8;
+			v4 = xxround(v4, read64(p));		p += 8;
+			} while ( p <= limit );
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = xxmerge(h, v1);
+		h = xxmerge(h, v2);
+		h = xxmerge(h, v3);
+		h = xxmerge(h, v4);
+		}
+	else
+		h = seed + P5;
+	h += (uint64_t) len;
+
+	for ( ; p + 8 <= end; p += 8 ) {
+		h ^= xxround(0, read64(p));
+		h  = rotl64(h, 27) * P1 + P4;
+		}
+	if ( p + 4 <= end ) {
+		h ^= (uint64_t) read32(p) * P1;
+		h  = rotl64(h, 23) * P2 + P3;
+		p += 4;
+		}
+	for ( ; p < end; p ++ ) {
+		h ^= (*p) * P5;
+		h  = rotl64(h, 11) * P1;
+		}
+
+	h ^= h >> 33;	h *= P2;
+	h ^= h >> 29;	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
+
+// reads 'len' bytes at 'off'; returns 0, or -1 on error or if the file is shorter now
+static int read_at(int fd, uint8_t *buf, size_t len, off_t off)
+{
+	ssize_t	n;
+
+	while ( len ) {
+		if ( (n = pread(fd, buf, len, off)) <= 0 ) {
+			if ( n < 0 && errno == EINTR )
+				continue;
+			return -1;
+			}
+		buf += n;
+		off += n;
+		len -= n;
+		}
+	return 0;
+}
+
+// the chunks of a big file, the thread 'first' of 'step' hashes first, first + step, ...
+typedef struct {
+	int		fd;
+	size_t	size;
+	uint64_t *hashes;
+	size_t	count, first, step;
+	int		error;
+	} hash_job_t;
+
+static void *hash_worker(void *arg)
+{
+	hash_job_t *job = (hash_job_t *) arg;
+	uint8_t	*buf = (uint8_t *) malloc(HASH_CHUNK);
+	size_t	len;
+
+	for ( size_t i = job->first; i < job->count; i += job->step ) {
+		len = ( i == job->count - 1 ) ? job->size - i * HASH_CHUNK : HASH_CHUNK;
+		if ( read_at(job->fd, buf, len, (off_t) (i * HASH_CHUNK)) != 0 ) {
+			job->error = 1;
+			break;
+			}
+		job->hashes[i] = hash64(buf, len, i);
+		}
+	free(buf);
+	return NULL;
+}
+
+// the hash of the first 'size' bytes of a big file; the chunks are read and
+// hashed in parallel. returns 0, or -1 if it cannot be read
+static int hash_chunks(int fd, size_t size, uint64_t *hash)
+{
+	hash_job_t	job[HASH_THREADS];
+	pthread_t	tid[HASH_THREADS];
+	int			started[HASH_THREADS], error = 0;
+	size_t		count, threads, i;
+	uint64_t	*hashes;
+	uint8_t		*buf;
+
+	if ( size <= HASH_CHUNK ) {
+		buf = (uint8_t *) malloc(size);
+		if ( (error = read_at(fd, buf, size, 0)) == 0 )
+			*hash = hash64(buf, size, 0);
+		free(buf);
+		return error;
+		}
+	count = (size + HASH_CHUNK - 1) / HASH_CHUNK;
+	threads = ( count < HASH_THREADS ) ? count : HASH_THREADS;
+	hashes = (uint64_t *) malloc(sizeof(uint64_t) * count);
+	for ( i = 0; i < threads; i ++ ) {
+		job[i].fd     = fd;
+		job[i].size   = size;
+		job[i].hashes = hashes;
+		job[i].count  = count;
+		job[i].first  = i;
+		job[i].step   = threads;
+		job[i].error  = 0;
+		started[i] = ( i > 0 && pthread_create(&tid[i], NULL, hash_worker, &job[i]) == 0 );
+		}
+	for ( i = 0; i < threads; i ++ ) {
+		if ( started[i] )
+			pthread_join(tid[i], NULL);
+		else
+			hash_worker(&job[i]);
+		error |= job[i].error;
+		}
+	if ( !error )
+		*hash = hash64(hashes, sizeof(uint64_t) * count, size);
+	free(hashes);
+	return ( error ) ? -1 : 0;
+}
+
+/*
+ * hashes the contents of the regular file 'name' (relative to 'dirfd');
+ * returns 0, or -1 if it cannot be read, it is not a regular file or it
+ * became shorter while it was read.
+ */
+int hash_file(int dirfd, const char *name, uint64_t *hash)
+{
+	struct stat st;
+	uint8_t	buf[HASH_READ];
+	ssize_t	n;
+	size_t	len = 0;
+	int		fd, status = 0;
+
+	// non-blocking, the open of a FIFO would wait for a writer
+	if ( (fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC | O_NONBLOCK)) < 0 )
+		return -1;
+	if ( fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || fcntl(fd, F_SETFL, 0) != 0 ) {
+		close(fd);
+		return -1;
+		}
+	if ( st.st_size < HASH_READ ) {
+		while ( len < sizeof(buf) && (n = read(fd, buf + len, sizeof(buf) - len)) != 0 ) {
+			if ( n < 0 ) {
+				if ( errno == EINTR )
+					continue;
+				close(fd);
+				return -1;
+				}
+			len += n;
+			}
+		*hash = hash64(buf, len, 0);
+		}
+	else
+		status = hash_chunks(fd, st.st_size, hash);
+	close(fd);
+	return status;
+}
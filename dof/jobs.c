@@ -0,0 +1,447 @@
+/*
+ *	Child processes pool
+ *
+ *	Copyright (C) 2017-2021 Nicholas Christopoulos.
+ *
+ *	This is free software: you can redistribute it and/or modify it under
+ *	the terms of the GNU General Public License as published by the
+ *	Free Software Foundation, either version 3 of the License, or (at your
+ *	option) any later version.
+ *
+ *	It is distributed in the hope that it will be useful, but WITHOUT ANY
+ *	WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *	for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with it. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * 	Written by Nicholas Christopoulos <nereus@freemail.gr>
+ */
+
+#define _GNU_SOURCE		// posix_spawn_file_actions_addchdir_np()
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "panic.h"
+#include "str.h"
+#include "jobs.h"
+
+static job_t	*jobs;			// the slots
+static int		jobs_alloc;		// number of slots
+static int		jobs_count;		// running jobs
+static int		jobs_shells;	// run the commands in persistent shells
+static const char *jobs_dir;	// the working directory of the new jobs; NULL = ours
+static const char *jobs_next_tag;	// the tag of the new jobs
+static void (*jobs_done)(const job_t *, int);	// called when a job finishes
+
+// posix_spawn_file_actions_addchdir_np(), glibc 2.29
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+	#define HAVE_SPAWN_CHDIR
+#endif
+
+extern char **environ;
+
+/*
+ * initialize the pool with 'max' slots; 0 = one per CPU
+ */
+int jobs_init(int max)
+{
+	if ( max <= 0 ) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		max = ( n > 0 ) ? (int) n : 1;
+		}
+	jobs = (job_t *) calloc(max, sizeof(job_t));
+	jobs_alloc = max;
+	jobs_count = 0;
+	return max;
+}
+
+// returns the number of slots
+int jobs_max()		{ return jobs_alloc; }
+
+// returns the number of running jobs
+int jobs_running()	{ return jobs_count; }
+
+// converts the status of waitpid() to exit code
+static int exit_code(int status)
+{
+	if ( WIFSIGNALED(status) )
+		return 128 + WTERMSIG(status);
+	return WEXITSTATUS(status);
+}
+
+// the job of the slot 'i' finished with the exit code; returns the code
+static int job_free(int i, int code)
+{
+	clock_gettime(CLOCK_MONOTONIC, &jobs[i].ended);
+	if ( jobs_done )
+		jobs_done(&jobs[i], code);
+	jobs[i].pid = 0;
+	free(jobs[i].item);
+	free(jobs[i].tag);
+	jobs[i].item = jobs[i].tag = NULL;
+	jobs_count --;
+	return code;
+}
+
+// the time before the spawn of a job; 'start' CLOCK_REALTIME, 'began' CLOCK_MONOTONIC
+static void job_clock(struct timespec *start, struct timespec *began)
+{
+	clock_gettime(CLOCK_REALTIME, start);
+	clock_gettime(CLOCK_MONOTONIC, began);
+}
+
+// the slot 'i' runs the job 'pid' for the item, spawned at 'start'/'began' (job_clock())
+static void job_start(int i, pid_t pid, const char *item, const struct timespec *start, const struct timespec *began)
+{
+	jobs[i].pid  = pid;
+	jobs[i].slot = i;
+	jobs[i].item = strdup(item);
+	jobs[i].tag  = ( jobs_next_tag ) ? strdup(jobs_next_tag) : NULL;
+	jobs[i].start = *start;
+	jobs[i].began = *began;
+	memset(&jobs[i].ru, 0, sizeof(struct rusage));
+	jobs_count ++;
+}
+
+// the job could not be started; it finishes at once with 127, as the shell does
+static int job_failed(int i, const char *item, const struct timespec *start, const struct timespec *began)
+{
+	job_start(i, 0, item, start, began);
+	return job_free(i, 127);
+}
+
+/*
+ * persistent shells
+ *
+ * each slot has its own shell that reads the commands from a pipe (stdin);
+ * after each command the shell writes its exit status to the fd 3. the
+ * commands read the original stdin (fd 4); they do not get the fds 3 and 4.
+ */
+
+// moves the fd above the standard ones and marks it close-on-exec
+static int fd_high(int fd)
+{
+	int nfd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+	close(fd);
+	return nfd;
+}
+
+// starts the shell of the slot
+static int shell_start(job_t *j)
+{
+	int		cmd[2], st[2], err;
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	sigset_t sigs;
+	char	*argv[] = { "/bin/sh", NULL };
+
+	if ( pipe(cmd) || pipe(st) ) {
+		error("pipe: %s", strerror(errno));
+		return -1;
+		}
+	cmd[0] = fd_high(cmd[0]); cmd[1] = fd_high(cmd[1]);
+	st[0]  = fd_high(st[0]);  st[1]  = fd_high(st[1]);
+
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_adddup2(&fa, 0, 4);
+	posix_spawn_file_actions_adddup2(&fa, cmd[0], 0);
+	posix_spawn_file_actions_adddup2(&fa, st[1], 3);
+	posix_spawnattr_init(&attr);
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &sigs);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+	err = posix_spawn(&j->shell, argv[0], &fa, &attr, argv, environ);
+	posix_spawn_file_actions_destroy(&fa);
+	posix_spawnattr_destroy(&attr);
+	close(cmd[0]);
+	close(st[1]);
+	if ( err ) {
+		error("%s: %s", argv[0], strerror(err));
+		close(cmd[1]);
+		close(st[0]);
+		j->shell = 0;
+		return -1;
+		}
+	j->fd_cmd = cmd[1];
+	j->fd_st  = st[0];
+	return 0;
+}
+
+// closes the shell of the slot; returns its exit code
+static int shell_stop(job_t *j)
+{
+	int		status = 0;
+
+	close(j->fd_cmd);
+	close(j->fd_st);
+	while ( waitpid(j->shell, &status, 0) < 0 && errno == EINTR );
+	j->shell = 0;
+	return exit_code(status);
+}
+
+// after the command; only the shell keeps the status pipe (fd 3) and the stdin (fd 4)
+#define SHELL_TAIL	" <&4 3>&- 4>&-; echo $? >&3\n"
+
+// sends the command to the shell of the slot
+static int shell_send(job_t *j, const char *command_line)
+{
+	char	cwd[PATH_MAX], *buf, *d;
+	size_t	len;
+	ssize_t	n;
+
+	if ( jobs_dir )
+		strcpy(cwd, jobs_dir);
+	else if ( getcwd(cwd, PATH_MAX) == NULL )
+		strcpy(cwd, ".");
+	buf = (char *) malloc(4 * (strlen(cwd) + strlen(command_line)) + 64);
+	d = buf;
+	memcpy(d, "cd ", 3);					d += 3;
+	d = shell_quote(d, cwd);
+	memcpy(d, " && eval ", 9);				d += 9;
+	d = shell_quote(d, command_line);
+	memcpy(d, SHELL_TAIL, sizeof(SHELL_TAIL) - 1);	d += sizeof(SHELL_TAIL) - 1;
+	len = d - buf;
+
+	for ( d = buf; len; d += n, len -= n ) {
+		if ( (n = write(j->fd_cmd, d, len)) < 0 ) {
+			if ( errno == EINTR )
+				{ n = 0; continue; }
+			break;
+			}
+		}
+	free(buf);
+	return ( len ) ? -1 : 0;
+}
+
+// runs the command in the shell of the slot, (re)starts the shell if needed
+static int shell_exec(job_t *j, const char *command_line)
+{
+	if ( j->shell == 0 && shell_start(j) )
+		return -1;
+	if ( shell_send(j, command_line) == 0 )
+		return 0;
+	shell_stop(j); // it is dead, try once more
+	if ( shell_start(j) == 0 && shell_send(j, command_line) == 0 )
+		return 0;
+	error("cannot send the command to the shell");
+	return -1;
+}
+
+// waits for a shell to finish its command; returns the exit code
+static int shell_wait()
+{
+	struct pollfd fds[jobs_alloc];
+	int		slot[jobs_alloc];
+	int		i, k, n;
+	char	buf[32];
+	ssize_t	len;
+
+	while ( jobs_count ) {
+		for ( i = n = 0; i < jobs_alloc; i ++ ) {
+			if ( jobs[i].pid ) {
+				fds[n].fd = jobs[i].fd_st;
+				fds[n].events = POLLIN;
+				fds[n].revents = 0;
+				slot[n ++] = i;
+				}
+			}
+		if ( poll(fds, n, -1) < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			error("poll: %s", strerror(errno));
+			return -1;
+			}
+		for ( k = 0; k < n; k ++ ) {
+			if ( fds[k].revents == 0 )
+				continue;
+			i = slot[k];
+			while ( (len = read(jobs[i].fd_st, buf, sizeof(buf) - 1)) < 0 && errno == EINTR );
+			if ( len > 0 ) {
+				buf[len] = '\0';
+				return job_free(i, atoi(buf));
+				}
+			return job_free(i, shell_stop(&jobs[i])); // the shell exited
+			}
+		}
+	return 0;
+}
+
+/*
+ * runs the commands of jobs_exec() in persistent shells instead of
+ * starting a new shell per command
+ */
+void jobs_coproc(int enable)
+{
+	jobs_shells = enable;
+	if ( enable )
+		signal(SIGPIPE, SIG_IGN);	// a dead shell, write() will return error
+}
+
+/*
+ * sets the working directory of the next jobs; the string must be valid
+ * until the job starts. NULL = the working directory of the process.
+ */
+void jobs_chdir(const char *dir)
+{
+	jobs_dir = dir;
+}
+
+/*
+ * sets the tag of the next jobs, it is copied; the callback of
+ * jobs_ondone() gets it back. NULL = no tag.
+ */
+void jobs_tag(const char *tag)
+{
+	jobs_next_tag = tag;
+}
+
+/*
+ * sets the function that is called when a job finishes, with the job
+ * and its exit code
+ */
+void jobs_ondone(void (*callback)(const job_t *job, int code))
+{
+	jobs_done = callback;
+}
+
+/*
+ * waits for one job to finish, frees its slot and returns its exit code;
+ * 128 + signal number if it was killed; 0 if there are no running jobs
+ */
+int jobs_wait()
+{
+	pid_t	pid;
+	int		status;
+	struct rusage ru;
+
+	if ( jobs_shells )
+		return shell_wait();
+	while ( jobs_count ) {
+		if ( (pid = wait4(-1, &status, 0, &ru)) < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			error("waitpid: %s", strerror(errno));
+			for ( int i = 0; i < jobs_alloc; i ++ ) {	// lost them
+				free(jobs[i].item);
+				free(jobs[i].tag);
+				jobs[i].item = jobs[i].tag = NULL;
+				jobs[i].pid = 0;
+				}
+			jobs_count = 0;
+			return -1;
+			}
+		for ( int i = 0; i < jobs_alloc; i ++ ) {
+			if ( jobs[i].pid == pid ) {
+				jobs[i].ru = ru;
+				return job_free(i, exit_code(status));
+				}
+			}
+		}
+	return 0;
+}
+
+// keeps the pool full but not overflowed; returns the first error
+static int jobs_fill()
+{
+	int		status, exit_status = 0;
+
+	while ( jobs_count >= jobs_alloc )
+		if ( (status = jobs_wait()) && !exit_status )
+			exit_status = status;
+	return exit_status;
+}
+
+/*
+ * starts the program 'argv[0]' in a free slot; no shell is involved
+ *
+ * when the pool is full, it waits for a job to finish; returns the exit
+ * code of the waited job or 0. with one slot this works as system().
+ */
+int jobs_spawn(char *const argv[], const char *item)
+{
+	int		i, err;
+	pid_t	pid;
+	struct timespec start, began;
+
+	if ( jobs == NULL )
+		jobs_init(1);
+	for ( i = 0; jobs[i].pid; i ++ );
+
+	fflush(stdout);
+	job_clock(&start, &began);
+	if ( jobs_dir == NULL )
+		err = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ);
+	else {
+	#ifdef HAVE_SPAWN_CHDIR
+		posix_spawn_file_actions_t fa;
+		posix_spawn_file_actions_init(&fa);
+		posix_spawn_file_actions_addchdir_np(&fa, jobs_dir);
+		err = posix_spawnp(&pid, argv[0], &fa, NULL, argv, environ);
+		posix_spawn_file_actions_destroy(&fa);
+	#else
+		if ( (pid = fork()) == 0 ) { // only the child changes directory
+			if ( chdir(jobs_dir) == 0 )
+				execvp(argv[0], argv);
+			error("%s: %s", argv[0], strerror(errno));
+			_exit(127);
+			}
+		err = ( pid < 0 ) ? errno : 0;
+	#endif
+		}
+	if ( err ) {
+		error("%s: %s", argv[0], strerror(err));
+		return job_failed(i, item, &start, &began);
+		}
+	job_start(i, pid, item, &start, &began);
+	return jobs_fill();
+}
+
+/*
+ * runs the 'command_line' with the shell in a free slot
+ */
+int jobs_exec(const char *command_line, const char *item)
+{
+	char *argv[] = { "/bin/sh", "-c", (char *) command_line, NULL };
+	int		i;
+	struct timespec start, began;
+
+	if ( !jobs_shells )
+		return jobs_spawn(argv, item);
+
+	if ( jobs == NULL )
+		jobs_init(1);
+	for ( i = 0; jobs[i].pid; i ++ );
+
+	fflush(stdout);
+	job_clock(&start, &began);
+	if ( shell_exec(&jobs[i], command_line) )
+		return job_failed(i, item, &start, &began);
+	job_start(i, jobs[i].shell, item, &start, &began);
+	return jobs_fill();
+}
+
+/*
+ * waits for all running jobs; returns the first non-zero exit status
+ */
+int jobs_finish()
+{
+	int		status, exit_status = 0;
+
+	while ( jobs_count )
+		if ( (status = jobs_wait()) && !exit_status )
+			exit_status = status;
+	for ( int i = 0; i < jobs_alloc; i ++ )
+		if ( jobs[i].shell )
+			shell_stop(&jobs[i]);
+	return exit_status;
+}
@@ -0,0 +1,65 @@
+/*
+ *	Child processes pool
+ *
+ *	Copyright (C) 2017-2021 Nicholas Christopoulos.
+ *
+ *	This is free software: you can redistribute it and/or modify it under
+ *	the terms of the GNU General Public License as published by the
+ *	Free Software Foundation, either version 3 of the License, or (at your
+ *	option) any later version.
+ *
+ *	It is distributed in the hope that it will be useful, but WITHOUT ANY
+ *	WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *	for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with it. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * 	Written by Nicholas Christopoulos <nereus@freemail.gr>
+ */
+
+#ifndef NDC_JOBS_H_
+#define NDC_JOBS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+typedef struct {
+	pid_t	pid;		// process id; 0 = free slot
+	char	*item;		// the item that this job serves
+	pid_t	shell;		// the persistent shell of the slot, if any
+	int		fd_cmd;		// pipe to the shell's stdin
+	int		fd_st;		// pipe from the shell; exit status of the commands
+	char	*tag;		// the data of the application for the job, see jobs_tag()
+	struct timespec start;	// when it started, CLOCK_REALTIME
+	struct timespec began, ended;	// when it started and finished, CLOCK_MONOTONIC
+	struct rusage ru;	// the resources of the finished job; zero in the persistent shells
+	int		slot;		// the index of the slot, 0 .. jobs_max() - 1
+	} job_t;
+
+int		jobs_init(int max);
+int		jobs_max();
+int		jobs_running();
+int		jobs_exec(const char *command_line, const char *item);
+int		jobs_spawn(char *const argv[], const char *item);
+int		jobs_wait();
+void	jobs_coproc(int enable);
+void	jobs_chdir(const char *dir);
+void	jobs_tag(const char *tag);
+void	jobs_ondone(void (*callback)(const job_t *job, int code));
+int		jobs_finish();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -27,41 +27,110 @@
 
 #define IF_DOTS(s) if((s)[0]=='.' && ((s)[1]=='\0' || ((s)[1]=='.' && (s)[2]=='\0')))
 
-/*
- * add node to list
- * this just stores a string in the list
- */
-list_node_t *list_add(list_t *list, const char *key)
+// FNV-1a
+static unsigned list_hash(const char *key)
 {
-	list_node_t *np = (list_node_t *) malloc(sizeof(list_node_t));
-	np->key  = strdup(key);
-	np->data = NULL;
+	unsigned h = 2166136261u;
+	while ( *key )
+		h = (h ^ (unsigned char) *key ++) * 16777619u;
+	return h;
+}
+
+// finds the node in the hash table
+static list_node_t *list_lookup(list_t *list, const char *key, unsigned hash)
+{
+	list_node_t *cur;
+
+	if ( list->table == NULL )
+		return NULL;
+	for ( cur = list->table[hash & (list->size - 1)]; cur; cur = cur->hnext )
+		if ( cur->hash == hash && strcmp(cur->key, key) == 0 )
+			return cur;
+	return NULL;
+}
+
+// doubles the hash table when the buckets are full
+static void list_rehash(list_t *list)
+{
+	list_node_t *cur;
+	unsigned	i;
+
+	if ( list->table && list->count < list->size )
+		return;
+	list->size = ( list->size ) ? list->size * 2 : 64;
+	free(list->table);
+	list->table = (list_node_t **) calloc(list->size, sizeof(list_node_t *));
+	for ( cur = list->root; cur; cur = cur->next ) {
+		i = cur->hash & (list->size - 1);
+		cur->hnext = list->table[i];
+		list->table[i] = cur;
+		}
+}
+
+// links the new node at the end of the list
+static list_node_t *list_link(list_t *list, list_node_t *np)
+{
+	np->hnext = NULL;
+	if ( list->flags & LIST_HASHED ) {
+		unsigned i;
+		list_rehash(list);
+		i = np->hash & (list->size - 1);
+		np->hnext = list->table[i];
+		list->table[i] = np;
+		}
 	np->next = NULL;
+	np->prev = list->tail;
 	if ( list->root ) {
 		list->tail->next = np;
 		list->tail = np;
 		}
 	else
 		list->root = list->tail = np;
+	list->count ++;
 	return np;
 }
 
+/*
+ * add node to list
+ * this just stores a string in the list
+ */
+list_node_t *list_add(list_t *list, const char *key)
+{
+	list_node_t *np;
+	unsigned	hash = 0;
+
+	if ( list->flags & LIST_HASHED ) {
+		hash = list_hash(key);
+		if ( (list->flags & LIST_UNIQUE) && (np = list_lookup(list, key, hash)) != NULL )
+			return np;
+		}
+	if ( list->arena ) { // the key follows the node
+		size_t len = strlen(key) + 1;
+		np = (list_node_t *) arena_alloc(list->arena, sizeof(list_node_t) + len);
+		np->key = memcpy(np + 1, key, len);
+		}
+	else {
+		np = (list_node_t *) malloc(sizeof(list_node_t));
+		np->key = strdup(key);
+		}
+	np->data = NULL;
+	np->hash = hash;
+	return list_link(list, np);
+}
+
 /*
  * add node to list
  * this stores a key and a value to the list
  */
 list_node_t *list_addp(list_t *list, const char *key, const char *value)
 {
-	list_node_t *np = (list_node_t *) malloc(sizeof(list_node_t));
-	np->key  = strdup(key);
-	np->data = strdup(value);
-	np->next = NULL;
-	if ( list->root ) {
-		list->tail->next = np;
-		list->tail = np;
+	list_node_t *np = list_add(list, key);
+	if ( list->arena )
+		np->data = arena_strdup(list->arena, value);
+	else {
+		free(np->data);
+		np->data = strdup(value);
 		}
-	else
-		list->root = list->tail = np;
 	return np;
 }
 
@@ -70,10 +139,23 @@ list_node_t *list_addp(list_t *list, const char *key, const char *value)
  * if list = null then creates a new list and returns its pointer
  */
 list_t *list_init(list_t *list)
+{
+	return list_init_set(list, 0);
+}
+
+/*
+ * Initialize list with hashed keys (LIST_HASHED), optionally unique (LIST_UNIQUE);
+ * the order of the insertion is kept
+ */
+list_t *list_init_set(list_t *list, int flags)
 {
 	if ( list == NULL )
 		list = (list_t *) malloc(sizeof(list_t));
+	list->flags = ( flags & LIST_UNIQUE ) ? (flags | LIST_HASHED) : flags;
 	list->root = list->tail = NULL;
+	list->table = NULL;
+	list->size = list->count = 0;
+	list->arena = ( flags & LIST_ARENA ) ? arena_create(0) : NULL;
 	return list;
 }
 
@@ -84,13 +166,30 @@ void list_clear(list_t *list)
 {
 	list_node_t *pre, *cur = list->root;
 
-	while ( cur ) {
-		pre = cur;
-		cur = cur->next;
-		free(pre->key);
-		free(pre);
+	if ( list->arena ) // all at once, the memory is kept for the next nodes
+		arena_reset(list->arena);
+	else {
+		while ( cur ) {
+			pre = cur;
+			cur = cur->next;
+			free(pre->key);
+			free(pre);
+			}
 		}
 	list->root = list->tail = NULL;
+	free(list->table);
+	list->table = NULL;
+	list->size = list->count = 0;
+}
+
+/*
+ *	Clean up memory, including the arena; the list must be initialized again to be used
+ */
+void list_release(list_t *list)
+{
+	list_clear(list);
+	arena_destroy(list->arena);
+	list->arena = NULL;
 }
 
 /*
@@ -98,26 +197,26 @@ void list_clear(list_t *list)
  */
 void list_remove(list_t *list, const char *key)
 {
-	list_node_t *pre = NULL, *cur = list->root;
-    
-	while ( cur ) {
-		if ( strcmp(cur->key, key) == 0 ) {
-			if ( pre ) {
-				if ( cur == list->tail ) // last node
-					list->tail = pre;
-				pre->next = cur->next;
-				}
-			else { // first node
-				if ( list->root == list->tail ) // the only one node
-					list->tail = cur->next;
-				list->root = cur->next;
-				}
-			free(cur->key);
-			free(cur);
-			break;
-			}
-		pre = cur;
-		cur = cur->next;
+	list_node_t *cur, **pp;
+
+	if ( (cur = list_find(list, key)) == NULL )
+		return;
+	if ( list->flags & LIST_HASHED ) {
+		for ( pp = &list->table[cur->hash & (list->size - 1)]; *pp != cur; pp = (list_node_t **) &(*pp)->hnext );
+		*pp = cur->hnext;
+		}
+	if ( cur->prev )
+		((list_node_t *) cur->prev)->next = cur->next;
+	else
+		list->root = cur->next;
+	if ( cur->next )
+		((list_node_t *) cur->next)->prev = cur->prev;
+	else
+		list->tail = cur->prev;
+	list->count --;
+	if ( list->arena == NULL ) {
+		free(cur->key);
+		free(cur);
 		}
 }
 
@@ -126,6 +225,8 @@ void list_remove(list_t *list, const char *key)
  */
 list_node_t *list_find(list_t *list, const char *key)
 {
+	if ( list->flags & LIST_HASHED )
+		return list_lookup(list, key, list_hash(key));
 	for ( list_node_t *cur = list->root; cur; cur = cur->next )
 		if ( strcmp(key, cur->key) == 0 )
 			return cur;
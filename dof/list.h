@@ -31,24 +31,38 @@ extern "C" {
 #include <stdlib.h>
 #include "str.h"
 
+#define LIST_HASHED	0x01	// the keys are indexed; O(1) list_find() and list_remove()
+#define LIST_UNIQUE	0x02	// no duplicate keys; list_add() returns the existing node
+#define LIST_ARENA	0x04	// the nodes and the keys are allocated in an arena, freed at once
+
 typedef struct {
 	char *key;
 	void *data;
 	void *next;
+	void *prev;
+	void *hnext;	// next in the hash bucket
+	unsigned hash;
 	} list_node_t;
 
 typedef struct {
 	int	flags;
 	list_node_t *root;
 	list_node_t *tail;
+	list_node_t **table;	// hash buckets, LIST_HASHED
+	unsigned size;			// number of buckets
+	unsigned count;			// number of nodes
+	arena_t *arena;			// LIST_ARENA
 	} list_t;
 
 list_t *list_init(list_t *list);
+list_t *list_init_set(list_t *list, int flags);
 void list_clear(list_t *list);
+void list_release(list_t *list);
 
 #ifndef list_create
 #define list_create()		list_init(NULL)
-#define list_destroy(l)		{ list_clear(l); free(l); l = NULL; }
+#define list_create_set(f)	list_init_set(NULL, (f))
+#define list_destroy(l)		{ list_release(l); free(l); l = NULL; }
 #endif
 
 list_node_t *list_add (list_t *list, const char *key);
@@ -0,0 +1,432 @@
+/*
+ *	Parallel directory walker
+ *
+ *	The threads read the directories; each one has its own deque of
+ *	directories to read, it takes the newest from its bottom and, when it
+ *	is empty, steals the oldest from the top of the others. The directories
+ *	are passed to the callback in the calling thread, so the callback does
+ *	not need to be thread-safe; only the prune function does.
+ *
+ *	The subdirectories are opened with openat() from the directory that is
+ *	read, and the callback gets the descriptor that was read, so a rename
+ *	of a parent does not change what is walked. The descriptors that wait
+ *	in the deques and in the output are limited to half of RLIMIT_NOFILE;
+ *	above that the directories are opened by their path.
+ *
+ *	Copyright (C) 2017-2021 Nicholas Christopoulos.
+ *
+ *	This is free software: you can redistribute it and/or modify it under
+ *	the terms of the GNU General Public License as published by the
+ *	Free Software Foundation, either version 3 of the License, or (at your
+ *	option) any later version.
+ *
+ *	It is distributed in the hope that it will be useful, but WITHOUT ANY
+ *	WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *	for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with it. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * 	Written by Nicholas Christopoulos <nereus@freemail.gr>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "panic.h"
+#include "file.h"
+#include "pwalk.h"
+
+// a directory; 'fd' is open, in the budget, or -1 to open it by 'path'
+typedef struct dir_s {
+	char	*path;
+	int		fd;
+	struct dir_s *next;
+	} dir_t;
+
+// deque of directories
+typedef struct {
+	dir_t	**ptr;
+	int		alloc;
+	int		top, bottom;	// the oldest, the next free
+	pthread_mutex_t lock;
+	} deque_t;
+
+static struct {
+	deque_t	*deques;
+	int		threads;
+	int		queued;			// directories in the deques
+	int		pending;		// directories in the deques or in process
+	volatile int stop;		// the callback failed
+	pthread_mutex_t lock;
+	pthread_cond_t	work;	// new directories or the end
+
+	dir_t	*head, *tail;	// finished, waiting for the callback
+	int		done;			// no more directories
+	pthread_mutex_t out_lock;
+	pthread_cond_t	out;
+
+	int		fds, maxfds;	// the descriptors held in dir_t, the budget
+
+	int		(*prune)(const char *, void *);
+	void	*params;
+	} pw;
+
+// reserves a descriptor of the budget; false if there is none
+static int pw_fd_take()
+{
+	if ( __atomic_add_fetch(&pw.fds, 1, __ATOMIC_RELAXED) <= pw.maxfds )
+		return 1;
+	__atomic_sub_fetch(&pw.fds, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+// closes the descriptor of the directory, if it has one
+static void pw_fd_close(dir_t *d)
+{
+	if ( d->fd >= 0 ) {
+		close(d->fd);
+		d->fd = -1;
+		__atomic_sub_fetch(&pw.fds, 1, __ATOMIC_RELAXED);
+		}
+}
+
+// frees the directory
+static void pw_free(dir_t *d)
+{
+	pw_fd_close(d);
+	free(d->path);
+	free(d);
+}
+
+// pushes the directory at the bottom of the deque
+static void dq_push(deque_t *q, dir_t *dir)
+{
+	pthread_mutex_lock(&q->lock);
+	if ( q->bottom - q->top == q->alloc ) { // full, grow
+		dir_t **ptr = (dir_t **) malloc(sizeof(dir_t *) * q->alloc * 2);
+		for ( int i = q->top; i < q->bottom; i ++ )
+			ptr[i - q->top] = q->ptr[i % q->alloc];
+		free(q->ptr);
+		q->ptr = ptr;
+		q->bottom -= q->top;
+		q->top = 0;
+		q->alloc *= 2;
+		}
+	q->ptr[q->bottom ++ % q->alloc] = dir;
+	pthread_mutex_unlock(&q->lock);
+}
+
+// takes the newest ('bottom' = 1, owner) or the oldest (thief) directory
+static dir_t *dq_take(deque_t *q, int bottom)
+{
+	dir_t	*dir = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	if ( q->top < q->bottom ) {
+		if ( bottom )
+			dir = q->ptr[-- q->bottom % q->alloc];
+		else
+			dir = q->ptr[q->top ++ % q->alloc];
+		}
+	pthread_mutex_unlock(&q->lock);
+	return dir;
+}
+
+// adds a directory to the thread's deque; it is counted before it is
+// visible, a thief cannot finish it before it is pending
+static void pw_add(int id, char *path, int fd)
+{
+	dir_t	*d = (dir_t *) malloc(sizeof(dir_t));
+
+	d->path = path;
+	d->fd = fd;
+	d->next = NULL;
+	pthread_mutex_lock(&pw.lock);
+	pw.queued ++;
+	pw.pending ++;
+	dq_push(&pw.deques[id], d);
+	pthread_cond_signal(&pw.work);
+	pthread_mutex_unlock(&pw.lock);
+}
+
+// the thread finished a directory
+static void pw_done()
+{
+	pthread_mutex_lock(&pw.lock);
+	if ( -- pw.pending == 0 ) {
+		pthread_cond_broadcast(&pw.work);
+		pthread_mutex_lock(&pw.out_lock);
+		pw.done = 1;
+		pthread_cond_signal(&pw.out);
+		pthread_mutex_unlock(&pw.out_lock);
+		}
+	pthread_mutex_unlock(&pw.lock);
+}
+
+// returns the next directory for the thread 'id' or NULL at the end
+static dir_t *pw_take(int id)
+{
+	dir_t	*dir;
+
+	for ( ;; ) {
+		dir = dq_take(&pw.deques[id], 1);
+		for ( int i = 1; dir == NULL && i < pw.threads; i ++ ) // steal
+			dir = dq_take(&pw.deques[(id + i) % pw.threads], 0);
+
+		pthread_mutex_lock(&pw.lock);
+		if ( dir ) {
+			pw.queued --;
+			pthread_mutex_unlock(&pw.lock);
+			if ( pw.stop ) { // just empty the deques
+				pw_free(dir);
+				pw_done();
+				continue;
+				}
+			return dir;
+			}
+		while ( pw.queued == 0 && pw.pending > 0 )
+			pthread_cond_wait(&pw.work, &pw.lock);
+		if ( pw.pending == 0 ) {
+			pthread_mutex_unlock(&pw.lock);
+			return NULL;
+			}
+		pthread_mutex_unlock(&pw.lock);
+		}
+}
+
+// passes the directory to the callback
+static void pw_output(dir_t *d)
+{
+	d->next = NULL;
+	pthread_mutex_lock(&pw.out_lock);
+	if ( pw.tail )
+		pw.tail->next = d;
+	else
+		pw.head = d;
+	pw.tail = d;
+	pthread_cond_signal(&pw.out);
+	pthread_mutex_unlock(&pw.out_lock);
+}
+
+// reads the directory; the subdirectories go to the deque of the thread
+static void pw_scan(int id, dir_t *d)
+{
+	struct dirent *entry;
+	struct stat st;
+	DIR		*dp;
+	int		fd, sfd, isdir;
+	char	*path = d->path;
+	size_t	len = strlen(path), nlen, n;
+	char	*sub;
+
+	if ( d->fd < 0 ) // the root, or no descriptor left in the budget
+		fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	else
+		fd = dup(d->fd);	// d->fd stays for the callback
+	if ( fd < 0 || (dp = fdopendir(fd)) == NULL ) {
+		warning("cannot open directory '%s'", path);
+		if ( fd >= 0 ) close(fd);
+		pw_free(d);
+		return;
+		}
+	if ( d->fd < 0 && pw_fd_take() && (d->fd = dup(fd)) < 0 )
+		__atomic_sub_fetch(&pw.fds, 1, __ATOMIC_RELAXED);
+
+	while ( !pw.stop && (entry = readdir(dp)) != NULL ) {
+		if ( isdots(entry->d_name) ) continue;
+		if ( entry->d_type == DT_UNKNOWN ) // the filesystem does not fill it
+			isdir = ( fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode) );
+		else
+			isdir = ( entry->d_type == DT_DIR );
+		if ( !isdir ) continue;
+
+		nlen = strlen(entry->d_name);
+		if ( len + nlen + 2 > PATH_MAX ) {
+			warning("%s/%s: path too long", path, entry->d_name);
+			continue;
+			}
+		sub = (char *) malloc(len + nlen + 2);
+		memcpy(sub, path, len);
+		n = len;
+		if ( len > 1 )
+			sub[n ++] = '/';
+		memcpy(sub + n, entry->d_name, nlen + 1);
+		if ( pw.prune && pw.prune(sub, pw.params) ) {
+			free(sub);
+			continue;
+			}
+		sfd = -1;
+		if ( pw_fd_take()
+				&& (sfd = openat(fd, entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) < 0 )
+			__atomic_sub_fetch(&pw.fds, 1, __ATOMIC_RELAXED);
+		pw_add(id, sub, sfd);
+		}
+	closedir(dp);
+	pw_output(d);
+}
+
+// thread
+static void *pw_worker(void *arg)
+{
+	int		id = (int) (intptr_t) arg;
+	dir_t	*dir;
+
+	while ( (dir = pw_take(id)) != NULL ) {
+		pw_scan(id, dir);
+		pw_done();
+		}
+	return NULL;
+}
+
+// compares two paths by their components, as the walker goes
+static int pw_cmp(const void *a, const void *b)
+{
+	const unsigned char *s1 = (const unsigned char *) (*(dir_t **) a)->path;
+	const unsigned char *s2 = (const unsigned char *) (*(dir_t **) b)->path;
+
+	for ( ; *s1 && *s1 == *s2; s1 ++, s2 ++ );
+	if ( *s1 == '/' && *s2 )	return -1;
+	if ( *s2 == '/' && *s1 )	return 1;
+	return (int) *s1 - (int) *s2;
+}
+
+// passes the directory to the callback, by its descriptor if it has one
+static int pw_callback(dir_t *d, int (*callback)(const char *, int, void *), void *params)
+{
+	int		fd = d->fd, status = 0;
+
+	if ( fd < 0 )
+		fd = open(d->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if ( fd >= 0 ) {
+		status = callback(d->path, fd, params);
+		if ( d->fd < 0 )
+			close(fd);
+		}
+	return status;
+}
+
+/*
+ * walks the directory tree of 'path' with 'threads' threads (0 = one per CPU);
+ * the directories that 'prune' returns true, and their subdirectories, are
+ * skipped. the callback runs in the calling thread and gets the absolute
+ * name of the directory and an fd of it.
+ */
+int pdwalk(const char *path, int threads,
+		int (*prune)(const char *, void *),
+		int (*callback)(const char *, int, void *),
+		int flags, void *params)
+{
+	char		*root = (char *) malloc(PATH_MAX);
+	pthread_t	*tid;
+	dir_t		*d, **sorted = NULL;
+	struct rlimit rl;
+	int			i, count = 0, alloc = 0, status = 0;
+
+	if ( path[0] == '/' )
+		strncpy(root, path, PATH_MAX - 1);
+	else if ( getcwd(root, PATH_MAX) == NULL ) {
+		error("getcwd: %s", strerror(errno));
+		free(root);
+		return -1;
+		}
+	else if ( strcmp(path, ".") != 0 ) {
+		if ( strlen(root) > 1 )
+			strcat(root, "/");
+		strncat(root, path, PATH_MAX - strlen(root) - 1);
+		}
+	root[PATH_MAX - 1] = '\0';
+	if ( prune && prune(root, params) ) {
+		free(root);
+		return 0;
+		}
+
+	if ( threads <= 0 ) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = ( n > 0 ) ? (int) n : 1;
+		}
+	memset(&pw, 0, sizeof(pw));
+	pw.threads = threads;
+	pw.prune   = prune;
+	pw.params  = params;
+	pw.maxfds  = ( getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < INT_MAX )
+		? (int) rl.rlim_cur / 2 : 512;
+	pthread_mutex_init(&pw.lock, NULL);
+	pthread_cond_init(&pw.work, NULL);
+	pthread_mutex_init(&pw.out_lock, NULL);
+	pthread_cond_init(&pw.out, NULL);
+	pw.deques = (deque_t *) calloc(threads, sizeof(deque_t));
+	for ( i = 0; i < threads; i ++ ) {
+		pw.deques[i].alloc = 64;
+		pw.deques[i].ptr = (dir_t **) malloc(sizeof(dir_t *) * 64);
+		pthread_mutex_init(&pw.deques[i].lock, NULL);
+		}
+	pw_add(0, root, -1);
+
+	tid = (pthread_t *) malloc(sizeof(pthread_t) * threads);
+	for ( i = 0; i < threads; i ++ )
+		pthread_create(&tid[i], NULL, pw_worker, (void *) (intptr_t) i);
+
+	// the directories as they come
+	for ( ;; ) {
+		pthread_mutex_lock(&pw.out_lock);
+		while ( pw.head == NULL && !pw.done )
+			pthread_cond_wait(&pw.out, &pw.out_lock);
+		if ( (d = pw.head) != NULL ) {
+			if ( (pw.head = d->next) == NULL )
+				pw.tail = NULL;
+			}
+		pthread_mutex_unlock(&pw.out_lock);
+		if ( d == NULL )
+			break;
+
+		if ( flags & PWALK_SORTED ) {
+			if ( count == alloc ) {
+				alloc = ( alloc ) ? alloc * 2 : 256;
+				sorted = (dir_t **) realloc(sorted, sizeof(dir_t *) * alloc);
+				}
+			sorted[count ++] = d;
+			}
+		else {
+			if ( status == 0 && (status = pw_callback(d, callback, params)) != 0 )
+				pw.stop = 1;
+			pw_free(d);
+			}
+		}
+
+	for ( i = 0; i < threads; i ++ )
+		pthread_join(tid[i], NULL);
+
+	// deterministic order
+	if ( flags & PWALK_SORTED ) {
+		qsort(sorted, count, sizeof(dir_t *), pw_cmp);
+		for ( i = 0; i < count; i ++ ) {
+			if ( status == 0 )
+				status = pw_callback(sorted[i], callback, params);
+			pw_free(sorted[i]);
+			}
+		free(sorted);
+		}
+
+	for ( i = 0; i < threads; i ++ ) {
+		free(pw.deques[i].ptr);
+		pthread_mutex_destroy(&pw.deques[i].lock);
+		}
+	free(pw.deques);
+	free(tid);
+	pthread_mutex_destroy(&pw.lock);
+	pthread_cond_destroy(&pw.work);
+	pthread_mutex_destroy(&pw.out_lock);
+	pthread_cond_destroy(&pw.out);
+	return status;
+}
@@ -0,0 +1,40 @@
+/*
+ *	Parallel directory walker
+ *
+ *	Copyright (C) 2017-2021 Nicholas Christopoulos.
+ *
+ *	This is free software: you can redistribute it and/or modify it under
+ *	the terms of the GNU General Public License as published by the
+ *	Free Software Foundation, either version 3 of the License, or (at your
+ *	option) any later version.
+ *
+ *	It is distributed in the hope that it will be useful, but WITHOUT ANY
+ *	WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *	for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with it. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * 	Written by Nicholas Christopoulos <nereus@freemail.gr>
+ */
+
+#ifndef NDC_PWALK_H_
+#define NDC_PWALK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PWALK_SORTED	0x01	// call back the directories in sorted order
+
+int		pdwalk(const char *path, int threads,
+			int (*prune)(const char *path, void *app_p),
+			int (*callback)(const char *path, int dirfd, void *app_p),
+			int flags, void *params);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,564 @@
+/*
+ *	Set of regular expressions
+ *
+ *	The patterns (POSIX extended, REG_NEWLINE) are compiled to one NFA
+ *	and a string is tested against all of them in one pass by a DFA that
+ *	is built while matching; the states that are never reached are never
+ *	built. The patterns that it cannot express (back-references, \w,
+ *	[=a=], etc) are left to regexec().
+ *
+ *	Copyright (C) 2017-2021 Nicholas Christopoulos.
+ *
+ *	This is free software: you can redistribute it and/or modify it under
+ *	the terms of the GNU General Public License as published by the
+ *	Free Software Foundation, either version 3 of the License, or (at your
+ *	option) any later version.
+ *
+ *	It is distributed in the hope that it will be useful, but WITHOUT ANY
+ *	WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *	for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with it. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * 	Written by Nicholas Christopoulos <nereus@freemail.gr>
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "rexset.h"
+
+#define RS_MAXNODES		0x10000	// the patterns beyond it go to regexec()
+#define RS_MAXREPEAT	64		// the {m,n} are copies; larger go to regexec()
+#define RS_MAXSTATES	1024	// the DFA cache is flushed when it is full
+
+enum { N_SET, N_SPLIT, N_EPS, N_BOL, N_EOL, N_MATCH };
+enum { A_SET, A_CAT, A_ALT, A_REP, A_BOL, A_EOL, A_EMPTY };
+
+// parse tree
+typedef struct ast_s {
+	int		type;
+	int		min, max;			// A_REP, max = -1 is infinite
+	unsigned char set[32];		// A_SET
+	struct ast_s *a, *b;
+	} ast_t;
+
+typedef struct {
+	const char *p;
+	int		err;				// cannot be expressed
+	} parser_t;
+
+#define set_add(s,c)	((s)[(unsigned char)(c) >> 3] |= 1 << ((unsigned char)(c) & 7))
+#define set_has(s,c)	((s)[(unsigned char)(c) >> 3] & (1 << ((unsigned char)(c) & 7)))
+
+static ast_t *ast_new(int type, ast_t *a, ast_t *b)
+{
+	ast_t *t = (ast_t *) calloc(1, sizeof(ast_t));
+	t->type = type;
+	t->a = a;
+	t->b = b;
+	return t;
+}
+
+static void ast_free(ast_t *t)
+{
+	if ( t ) {
+		ast_free(t->a);
+		ast_free(t->b);
+		free(t);
+		}
+}
+
+static ast_t *parse_alt(parser_t *ps, int depth);
+
+// [...]
+static ast_t *parse_bracket(parser_t *ps)
+{
+	ast_t	*t = ast_new(A_SET, NULL, NULL);
+	const char *p = ps->p + 1, *e;
+	int		neg = 0, first = 1, c, i;
+
+	if ( *p == '^' ) { neg = 1; p ++; }
+	for ( ;; first = 0 ) {
+		if ( *p == '\0' )
+			{ ps->err = 1; return t; }
+		if ( *p == ']' && !first )
+			break;
+		if ( *p == '[' && p[1] == ':' ) {
+			char	name[16];
+			if ( (e = strstr(p + 2, ":]")) == NULL || e - p - 2 >= (int) sizeof(name) )
+				{ ps->err = 1; return t; }
+			memcpy(name, p + 2, e - p - 2);
+			name[e - p - 2] = '\0';
+			for ( c = 1; c < 256; c ++ ) {
+				int in;
+				if      ( strcmp(name, "alpha") == 0 )	in = isalpha(c);
+				else if ( strcmp(name, "digit") == 0 )	in = isdigit(c);
+				else if ( strcmp(name, "alnum") == 0 )	in = isalnum(c);
+				else if ( strcmp(name, "upper") == 0 )	in = isupper(c);
+				else if ( strcmp(name, "lower") == 0 )	in = islower(c);
+				else if ( strcmp(name, "space") == 0 )	in = isspace(c);
+				else if ( strcmp(name, "blank") == 0 )	in = isblank(c);
+				else if ( strcmp(name, "punct") == 0 )	in = ispunct(c);
+				else if ( strcmp(name, "print") == 0 )	in = isprint(c);
+				else if ( strcmp(name, "graph") == 0 )	in = isgraph(c);
+				else if ( strcmp(name, "cntrl") == 0 )	in = iscntrl(c);
+				else if ( strcmp(name, "xdigit") == 0 )	in = isxdigit(c);
+				else { ps->err = 1; return t; }
+				if ( in )
+					set_add(t->set, c);
+				}
+			p = e + 2;
+			continue;
+			}
+		if ( *p == '[' && (p[1] == '=' || p[1] == '.') )
+			{ ps->err = 1; return t; }
+		c = (unsigned char) *p;
+		if ( p[1] == '-' && p[2] && p[2] != ']' ) { // range
+			if ( p[2] == '[' || (unsigned char) p[2] < c )
+				{ ps->err = 1; return t; }
+			for ( i = c; i <= (unsigned char) p[2]; i ++ )
+				set_add(t->set, i);
+			p += 3;
+			}
+		else {
+			set_add(t->set, c);
+			p ++;
+			}
+		}
+	ps->p = p + 1;
+	if ( neg ) {
+		for ( i = 0; i < 32; i ++ )
+			t->set[i] = ~t->set[i];
+		t->set['\n' >> 3] &= ~(1 << ('\n' & 7));	// REG_NEWLINE
+		}
+	t->set[0] &= ~1;	// NUL
+	return t;
+}
+
+// one character, group, or anchor
+static ast_t *parse_atom(parser_t *ps, int depth)
+{
+	ast_t	*t;
+	int		i;
+
+	switch ( *ps->p ) {
+	case '(':
+		ps->p ++;
+		t = parse_alt(ps, depth + 1);
+		if ( *ps->p != ')' )
+			ps->err = 1;
+		else
+			ps->p ++;
+		return t;
+	case '[':
+		return parse_bracket(ps);
+	case '^':
+		ps->p ++;
+		return ast_new(A_BOL, NULL, NULL);
+	case '$':
+		ps->p ++;
+		return ast_new(A_EOL, NULL, NULL);
+	case '.':
+		ps->p ++;
+		t = ast_new(A_SET, NULL, NULL);
+		for ( i = 1; i < 256; i ++ )
+			if ( i != '\n' )	// REG_NEWLINE
+				set_add(t->set, i);
+		return t;
+	case '*': case '+': case '?': case '{': case ')':
+		ps->err = 1;
+		return ast_new(A_EMPTY, NULL, NULL);
+	case '\\':
+		ps->p ++;
+		if ( *ps->p == '\0' || isalnum((unsigned char) *ps->p) ) { // \1, \w, \b, ...
+			ps->err = 1;
+			return ast_new(A_EMPTY, NULL, NULL);
+			}
+		// fall through
+	default:
+		t = ast_new(A_SET, NULL, NULL);
+		set_add(t->set, *ps->p);
+		ps->p ++;
+		return t;
+		}
+}
+
+// parses {m}, {m,}, {m,n}
+static int parse_bounds(parser_t *ps, int *min, int *max)
+{
+	char	*e;
+
+	*min = *max = (int) strtol(ps->p + 1, &e, 10);
+	if ( *e == ',' ) {
+		if ( isdigit((unsigned char) e[1]) )
+			*max = (int) strtol(e + 1, &e, 10);
+		else {
+			*max = -1;
+			e ++;
+			}
+		}
+	if ( *e != '}' || *min > RS_MAXREPEAT || *max > RS_MAXREPEAT || (*max >= 0 && *max < *min) )
+		return -1;
+	ps->p = e + 1;
+	return 0;
+}
+
+// atom and its repetitions
+static ast_t *parse_piece(parser_t *ps, int depth)
+{
+	ast_t	*t = parse_atom(ps, depth);
+	int		min, max;
+
+	while ( !ps->err ) {
+		switch ( *ps->p ) {
+		case '*': min = 0; max = -1; ps->p ++; break;
+		case '+': min = 1; max = -1; ps->p ++; break;
+		case '?': min = 0; max = 1;  ps->p ++; break;
+		case '{':
+			if ( !isdigit((unsigned char) ps->p[1]) || parse_bounds(ps, &min, &max) )
+				{ ps->err = 1; return t; }
+			break;
+		default:
+			return t;
+			}
+		if ( t->type == A_BOL || t->type == A_EOL ) // literal '*' in some regcomp()s
+			{ ps->err = 1; return t; }
+		t = ast_new(A_REP, t, NULL);
+		t->min = min;
+		t->max = max;
+		}
+	return t;
+}
+
+// concatenation
+static ast_t *parse_cat(parser_t *ps, int depth)
+{
+	ast_t	*t = NULL, *piece;
+
+	while ( !ps->err && *ps->p && *ps->p != '|' && !(*ps->p == ')' && depth) ) {
+		piece = parse_piece(ps, depth);
+		t = ( t ) ? ast_new(A_CAT, t, piece) : piece;
+		}
+	return ( t ) ? t : ast_new(A_EMPTY, NULL, NULL);
+}
+
+// alternation
+static ast_t *parse_alt(parser_t *ps, int depth)
+{
+	ast_t	*t = parse_cat(ps, depth);
+
+	while ( !ps->err && *ps->p == '|' ) {
+		ps->p ++;
+		t = ast_new(A_ALT, t, parse_cat(ps, depth));
+		}
+	return t;
+}
+
+// new NFA node
+static int node_new(rexset_t *rs, int type, int out, int out1)
+{
+	rs_node_t *n;
+
+	if ( rs->count == rs->alloc ) {
+		rs->alloc = ( rs->alloc ) ? rs->alloc * 2 : 256;
+		rs->nodes = (rs_node_t *) realloc(rs->nodes, sizeof(rs_node_t) * rs->alloc);
+		}
+	n = &rs->nodes[rs->count];
+	memset(n, 0, sizeof(rs_node_t));
+	n->type = type;
+	n->out  = out;
+	n->out1 = out1;
+	return rs->count ++;
+}
+
+// compiles the tree to NFA nodes that continue to 'next'; returns the first node
+static int compile(rexset_t *rs, ast_t *t, int next)
+{
+	int		i, s, tail;
+
+	if ( rs->count > RS_MAXNODES )
+		return next;
+	switch ( t->type ) {
+	case A_SET:
+		i = node_new(rs, N_SET, next, -1);
+		memcpy(rs->nodes[i].set, t->set, 32);
+		return i;
+	case A_CAT:
+		return compile(rs, t->a, compile(rs, t->b, next));
+	case A_ALT:
+		return node_new(rs, N_SPLIT, compile(rs, t->a, next), compile(rs, t->b, next));
+	case A_BOL:
+		return node_new(rs, N_BOL, next, -1);
+	case A_EOL:
+		return node_new(rs, N_EOL, next, -1);
+	case A_REP:
+		if ( t->max < 0 ) { // loop
+			s = node_new(rs, N_SPLIT, -1, next);
+			i = compile(rs, t->a, s);	// it may move the nodes
+			rs->nodes[s].out = i;
+			tail = s;
+			}
+		else { // the optional copies, nested
+			for ( tail = next, i = t->min; i < t->max; i ++ ) {
+				s = node_new(rs, N_SPLIT, -1, next);
+				int out = compile(rs, t->a, tail);
+				rs->nodes[s].out = out;
+				tail = s;
+				}
+			}
+		for ( i = 0; i < t->min; i ++ )
+			tail = compile(rs, t->a, tail);
+		return tail;
+		}
+	return node_new(rs, N_EPS, next, -1);
+}
+
+/*
+ * creates an empty set
+ */
+rexset_t *rexset_create()
+{
+	rexset_t *rs = (rexset_t *) calloc(1, sizeof(rexset_t));
+
+	node_new(rs, N_MATCH, -1, -1);	// node 0
+	rs->start = -1;
+	pthread_mutex_init(&rs->lock, NULL);
+	return rs;
+}
+
+// drops the DFA
+static void dfa_flush(rexset_t *rs)
+{
+	for ( int i = 0; i < rs->nstates; i ++ ) {
+		free(rs->states[i]->kernel);
+		free(rs->states[i]->sets);
+		free(rs->states[i]);
+		}
+	rs->nstates = 0;
+	rs->start = -1;
+	if ( rs->hash )
+		memset(rs->hash, 0, sizeof(int) * rs->hsize);
+}
+
+/*
+ * adds the pattern; 're' is the same pattern compiled by regcomp() with
+ * REG_EXTENDED | REG_NEWLINE, it must be valid while the set is used.
+ */
+void rexset_add(rexset_t *rs, const char *pattern, regex_t *re)
+{
+	parser_t ps = { pattern, 0 };
+	ast_t	*t = parse_alt(&ps, 0);
+	int		count = rs->count, start;
+
+	rs->all = (regex_t **) realloc(rs->all, sizeof(regex_t *) * (rs->nall + 1));
+	rs->all[rs->nall ++] = re;
+	if ( !ps.err && *ps.p == '\0' ) {
+		start = compile(rs, t, 0);
+		if ( rs->count <= RS_MAXNODES ) {
+			rs->starts = (int *) realloc(rs->starts, sizeof(int) * (rs->nstarts + 1));
+			rs->starts[rs->nstarts ++] = start;
+			dfa_flush(rs);
+			free(rs->mark);		// new size
+			free(rs->stack);
+			rs->mark = rs->stack = NULL;
+			ast_free(t);
+			return;
+			}
+		rs->count = count;
+		}
+	ast_free(t);
+	rs->other = (regex_t **) realloc(rs->other, sizeof(regex_t *) * (rs->nother + 1));
+	rs->other[rs->nother ++] = re;
+}
+
+static int int_cmp(const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+// finds or creates the state of the kernel; returns its index
+static int dfa_state(rexset_t *rs, int *kernel, int nkernel, int bol)
+{
+	rs_state_t *st;
+	unsigned h = 2166136261u;
+	int		i, k, n, top;
+
+	qsort(kernel, nkernel, sizeof(int), int_cmp);
+	for ( i = k = 0; i < nkernel; i ++ ) // unique
+		if ( i == 0 || kernel[i] != kernel[k - 1] )
+			kernel[k ++] = kernel[i];
+	nkernel = k;
+	for ( i = 0; i < nkernel; i ++ )
+		h = (h ^ (unsigned) kernel[i]) * 16777619u;
+	h = (h ^ (unsigned) bol) * 16777619u;
+
+	if ( rs->hash == NULL ) {
+		rs->hsize = RS_MAXSTATES * 2;
+		rs->hash = (int *) calloc(rs->hsize, sizeof(int));
+		}
+	for ( i = h % rs->hsize; rs->hash[i]; i = (i + 1) % rs->hsize ) {
+		st = rs->states[rs->hash[i] - 1];
+		if ( st->bol == bol && st->nkernel == nkernel && memcmp(st->kernel, kernel, sizeof(int) * nkernel) == 0 )
+			return rs->hash[i] - 1;
+		}
+
+	// new state
+	st = (rs_state_t *) malloc(sizeof(rs_state_t));
+	st->kernel = (int *) malloc(sizeof(int) * (nkernel + 1));
+	memcpy(st->kernel, kernel, sizeof(int) * nkernel);
+	st->nkernel = nkernel;
+	st->bol = bol;
+	st->sets = (int *) malloc(sizeof(int) * (rs->count + 1));
+	st->nsets = 0;
+	st->accept = st->accept_eol = 0;
+	for ( k = 0; k < 256; k ++ )
+		st->next[k] = -1;
+
+	// closure; the second pass is the end of the string
+	for ( int eol = 0; eol < 2; eol ++ ) {
+		rs->gen ++;
+		for ( top = 0, k = 0; k < nkernel; k ++ )
+			rs->stack[top ++] = kernel[k];
+		while ( top ) {
+			n = rs->stack[-- top];
+			if ( n < 0 || rs->mark[n] == rs->gen )
+				continue;
+			rs->mark[n] = rs->gen;
+			switch ( rs->nodes[n].type ) {
+			case N_SET:
+				if ( !eol ) st->sets[st->nsets ++] = n;
+				break;
+			case N_MATCH:
+				if ( eol ) st->accept_eol = 1; else st->accept = 1;
+				break;
+			case N_SPLIT:
+				rs->stack[top ++] = rs->nodes[n].out1;
+				// fall through
+			case N_EPS:
+				rs->stack[top ++] = rs->nodes[n].out;
+				break;
+			case N_BOL:
+				if ( bol ) rs->stack[top ++] = rs->nodes[n].out;
+				break;
+			case N_EOL:
+				if ( eol ) rs->stack[top ++] = rs->nodes[n].out;
+				break;
+				}
+			}
+		}
+	if ( st->accept )
+		st->accept_eol = 1;
+
+	if ( rs->states == NULL )
+		rs->states = (rs_state_t **) malloc(sizeof(rs_state_t *) * RS_MAXSTATES);
+	rs->states[rs->nstates] = st;
+	for ( i = h % rs->hsize; rs->hash[i]; i = (i + 1) % rs->hsize );
+	rs->hash[i] = rs->nstates + 1;
+	return rs->nstates ++;
+}
+
+// returns the next state of 's' with the byte 'c'
+static int dfa_next(rexset_t *rs, int s, unsigned char c)
+{
+	rs_state_t *st = rs->states[s];
+	int		*kernel = (int *) malloc(sizeof(int) * (st->nsets + rs->nstarts + 1));
+	int		n = 0, next;
+
+	for ( int i = 0; i < st->nsets; i ++ ) {
+		rs_node_t *node = &rs->nodes[st->sets[i]];
+		if ( set_has(node->set, c) )
+			kernel[n ++] = node->out;
+		}
+	memcpy(kernel + n, rs->starts, sizeof(int) * rs->nstarts);	// not anchored, a match may start anywhere
+	n += rs->nstarts;
+	if ( rs->nstates == RS_MAXSTATES ) {
+		dfa_flush(rs);
+		st = NULL;
+		}
+	next = dfa_state(rs, kernel, n, 0);
+	if ( st )
+		st->next[c] = next;
+	free(kernel);
+	return next;
+}
+
+/*
+ * returns true if any of the patterns matches the string, as regexec()
+ */
+int rexset_match(rexset_t *rs, const char *source)
+{
+	const unsigned char *p;
+	int		s, match = 0;
+
+	if ( strchr(source, '\n') ) { // REG_NEWLINE anchors, regexec() knows them
+		for ( int i = 0; i < rs->nall; i ++ )
+			if ( regexec(rs->all[i], source, 0, NULL, 0) == 0 )
+				return 1;
+		return 0;
+		}
+
+	if ( rs->nstarts ) {
+		pthread_mutex_lock(&rs->lock);
+		if ( rs->mark == NULL ) { // first match after rexset_add()
+			rs->mark  = (int *) calloc(rs->count, sizeof(int));
+			rs->stack = (int *) malloc(sizeof(int) * (rs->count * 3 + 2));
+			rs->gen = 0;
+			}
+		if ( rs->start < 0 ) { // new or flushed
+			if ( rs->nstates == RS_MAXSTATES )
+				dfa_flush(rs);
+			int *kernel = (int *) malloc(sizeof(int) * rs->nstarts);
+			memcpy(kernel, rs->starts, sizeof(int) * rs->nstarts);
+			rs->start = dfa_state(rs, kernel, rs->nstarts, 1);
+			free(kernel);
+			}
+		s = rs->start;
+		match = rs->states[s]->accept;
+		for ( p = (const unsigned char *) source; *p && !match; p ++ ) {
+			int next = rs->states[s]->next[*p];
+			s = ( next < 0 ) ? dfa_next(rs, s, *p) : next;
+			match = rs->states[s]->accept;
+			// nothing can be read; after one more byte the state is only the
+			// (anchored) starts, the same to the end of the string
+			if ( rs->states[s]->nsets == 0 && p[1] && !match ) {
+				next = rs->states[s]->next[p[1]];
+				s = ( next < 0 ) ? dfa_next(rs, s, p[1]) : next;
+				match = rs->states[s]->accept;
+				break;
+				}
+			}
+		if ( !match )
+			match = rs->states[s]->accept_eol;
+		pthread_mutex_unlock(&rs->lock);
+		}
+
+	for ( int i = 0; !match && i < rs->nother; i ++ )
+		match = ( regexec(rs->other[i], source, 0, NULL, 0) == 0 );
+	return match;
+}
+
+/*
+ * frees the set; the regex_t of the patterns are not freed
+ */
+void rexset_free(rexset_t *rs)
+{
+	if ( rs == NULL )
+		return;
+	dfa_flush(rs);
+	free(rs->states);
+	free(rs->hash);
+	free(rs->nodes);
+	free(rs->starts);
+	free(rs->all);
+	free(rs->other);
+	free(rs->mark);
+	free(rs->stack);
+	pthread_mutex_destroy(&rs->lock);
+	free(rs);
+}
@@ -0,0 +1,73 @@
+/*
+ *	Set of regular expressions
+ *
+ *	Copyright (C) 2017-2021 Nicholas Christopoulos.
+ *
+ *	This is free software: you can redistribute it and/or modify it under
+ *	the terms of the GNU General Public License as published by the
+ *	Free Software Foundation, either version 3 of the License, or (at your
+ *	option) any later version.
+ *
+ *	It is distributed in the hope that it will be useful, but WITHOUT ANY
+ *	WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *	for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with it. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * 	Written by Nicholas Christopoulos <nereus@freemail.gr>
+ */
+
+#ifndef NDC_REXSET_H_
+#define NDC_REXSET_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <regex.h>
+#include <pthread.h>
+
+// NFA node
+typedef struct {
+	int		type;
+	int		out, out1;
+	unsigned char set[32];	// the bytes of N_SET
+	} rs_node_t;
+
+// DFA state, a set of NFA nodes
+typedef struct {
+	int		*kernel, nkernel;	// the NFA nodes, sorted
+	int		bol;				// at the beginning of the string
+	int		*sets, nsets;		// the N_SET nodes of its closure
+	int		accept;				// matched
+	int		accept_eol;			// matched at the end of the string
+	int		next[256];			// the transitions, -1 = not built yet
+	} rs_state_t;
+
+typedef struct {
+	rs_node_t *nodes;			// the NFA of all patterns
+	int		count, alloc;
+	int		*starts, nstarts;	// the first node of each pattern
+	regex_t	**all;				// all the patterns, compiled with regcomp()
+	int		nall;
+	regex_t	**other;			// the patterns that the DFA cannot express
+	int		nother;
+	rs_state_t **states;		// the DFA, built while matching
+	int		nstates, start;
+	int		*hash, hsize;
+	int		*mark, gen, *stack;
+	pthread_mutex_t lock;
+	} rexset_t;
+
+rexset_t *rexset_create();
+void	rexset_add(rexset_t *rs, const char *pattern, regex_t *re);
+int		rexset_match(rexset_t *rs, const char *source);
+void	rexset_free(rexset_t *rs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
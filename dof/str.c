@@ -245,32 +245,86 @@ int res_match(const char *pattern, const char *source)
 	return 0;
 }
 
-//
-int rex_replace(regex_t *r, char *source, const char *repl, size_t max_matches)
+/*
+ * replaces the matches of 'r' in 'source' with 'repl', up to 'max_matches';
+ * in 'repl', \1 to \9 are the groups of the match, \0 is the match and \\
+ * is the backslash. the result is built in one pass to '*dest', which is
+ * (re)allocated as needed, '*size' is its size. returns the replacements.
+ */
+size_t rex_subst(regex_t *r, const char *source, const char *repl, size_t max_matches, char **dest, size_t *size)
 {
-	size_t max_groups = 1, m, beg, end, rplen = strlen(repl);
-	regmatch_t groups[max_groups];
-	char *p = source, *buf = (char *) malloc(strlen(source) + rplen * max_matches + 1);
-	char *bp = buf;
-
-	p = source;
-	for ( m = 0; *p && m < max_matches; m ++ ) {
-		if ( regexec(r, p, max_groups, groups, 0) )
+	regmatch_t	groups[10];
+	const char	*p = source, *s;
+	size_t		len = 0, n, count = 0;
+	int			k, eflags = 0, after = 0;
+
+	#define rex_room(need)	\
+		if ( len + (need) + 1 > *size ) { *size = (len + (need) + 1) * 2; *dest = (char *) realloc(*dest, *size); }
+
+	while ( count < max_matches ) {
+		if ( regexec(r, p, 10, groups, eflags) )
 			break;  // No more matches
-		beg = groups[0].rm_so;
-		end = groups[0].rm_eo;
-		if ( beg ) {
-			strncpy(bp, p, beg);
-			bp += beg;
+		eflags = REG_NOTBOL;
+		if ( groups[0].rm_eo == 0 && after ) { // empty, at the end of the previous match
+			if ( *p == '\0' )
+				break;
+			rex_room(1);
+			(*dest)[len ++] = *p ++;
+			after = 0;
+			continue;
 			}
-		if ( rplen ) {
-			strcpy(bp, repl);
-			bp += rplen;
+
+		// the text before the match
+		n = groups[0].rm_so;
+		rex_room(n);
+		memcpy(*dest + len, p, n);
+		len += n;
+
+		// the replacement
+		for ( s = repl; *s; s ++ ) {
+			if ( *s == '\\' && isdigit(s[1]) ) {
+				k = *++ s - '0';
+				if ( groups[k].rm_so >= 0 ) {
+					n = groups[k].rm_eo - groups[k].rm_so;
+					rex_room(n);
+					memcpy(*dest + len, p + groups[k].rm_so, n);
+					len += n;
+					}
+				continue;
+				}
+			if ( *s == '\\' && s[1] == '\\' )
+				s ++;
+			rex_room(1);
+			(*dest)[len ++] = *s;
+			}
+
+		count ++;
+		p += groups[0].rm_eo;
+		after = 1;
+		if ( groups[0].rm_so == groups[0].rm_eo ) { // empty match, move on
+			if ( *p == '\0' )
+				break;
+			rex_room(1);
+			(*dest)[len ++] = *p ++;
+			after = 0;
 			}
-		p += end;
 		}
-	*bp = '\0';
-	strcat(bp, p);
+
+	// the rest
+	n = strlen(p);
+	rex_room(n);
+	memcpy(*dest + len, p, n + 1);
+	#undef rex_room
+	return count;
+}
+
+// as rex_subst(), in place; 'source' must have room for the result
+int rex_replace(regex_t *r, char *source, const char *repl, size_t max_matches)
+{
+	char	*buf = NULL;
+	size_t	size = 0;
+
+	rex_subst(r, source, repl, max_matches, &buf, &size);
 	strcpy(source, buf);
 	free(buf);
 	return 1;
@@ -288,3 +342,119 @@ int res_replace(const char *pattern, char *source, const char *repl, size_t max_
 	regfree(&r);
 	return status;
 }
+
+// appends 'source' to 'dest' quoted for the shell, if it needs it;
+// 'dest' needs up to 4 * strlen(source) + 3 bytes
+char *shell_quote(char *dest, const char *source)
+{
+	const char *p;
+	char *d = dest;
+
+	if ( *source && strspn(source, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_+-.,/:@%=") == strlen(source) ) {
+		for ( p = source; *p; *d ++ = *p ++ );
+		return d;
+		}
+	*d ++ = '\'';
+	for ( p = source; *p; p ++ ) {
+		if ( *p == '\'' ) { // close, escaped quote, reopen
+			memcpy(d, "'\\''", 4);
+			d += 4;
+			}
+		else
+			*d ++ = *p;
+		}
+	*d ++ = '\'';
+	return d;
+}
+
+// arena
+
+// the alignment of the allocations
+#define ARENA_ALIGN	(sizeof(void *) * 2)
+
+// the header of the block, aligned
+#define ARENA_HEADER	((sizeof(arena_block_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+// the data of the block
+#define arena_data(b)	((char *) (b) + ARENA_HEADER)
+
+/*
+ * creates an arena; the memory is allocated in blocks of 'block_size' bytes
+ */
+arena_t *arena_create(size_t block_size)
+{
+	arena_t *a = (arena_t *) malloc(sizeof(arena_t));
+	a->head = a->cur = NULL;
+	a->block_size = ( block_size ) ? block_size : 0x10000;
+	return a;
+}
+
+/*
+ * allocates 'size' bytes; they are freed by arena_reset() or arena_destroy()
+ */
+void *arena_alloc(arena_t *a, size_t size)
+{
+	arena_block_t *b = a->cur, *nb;
+	void	*p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if ( b == NULL || b->used + size > b->size ) {
+		// the next block, kept by arena_reset(), if it is big enough
+		if ( b && b->next && b->next->size >= size ) {
+			nb = b->next;
+			nb->used = 0;
+			}
+		else {
+			size_t bsize = ( size > a->block_size ) ? size : a->block_size;
+			nb = (arena_block_t *) malloc(ARENA_HEADER + bsize);
+			nb->size = bsize;
+			nb->used = 0;
+			if ( b ) {
+				nb->next = b->next;
+				b->next = nb;
+				}
+			else {
+				nb->next = a->head;
+				a->head = nb;
+				}
+			}
+		a->cur = b = nb;
+		}
+	p = arena_data(b) + b->used;
+	b->used += size;
+	return p;
+}
+
+/*
+ * copies the string in the arena
+ */
+char *arena_strdup(arena_t *a, const char *source)
+{
+	size_t	len = strlen(source) + 1;
+	return (char *) memcpy(arena_alloc(a, len), source, len);
+}
+
+/*
+ * frees all the allocations at once; the blocks are kept for reuse
+ */
+void arena_reset(arena_t *a)
+{
+	if ( (a->cur = a->head) != NULL )
+		a->head->used = 0;
+}
+
+/*
+ * frees the arena
+ */
+void arena_destroy(arena_t *a)
+{
+	arena_block_t *b, *next;
+
+	if ( a == NULL )
+		return;
+	for ( b = a->head; b; b = next ) {
+		next = b->next;
+		free(b);
+		}
+	free(a);
+}
@@ -42,6 +42,21 @@ typedef struct {
 	int	alloc;			// allocation size (used for realloc)
 	} cwords_t;
 
+/*
+ *	arena; bump allocator, everything is freed at once
+ */
+typedef struct arena_block_s {
+	struct arena_block_s *next;
+	size_t	size;		// bytes of data
+	size_t	used;
+	} arena_block_t;
+
+typedef struct {
+	arena_block_t *head;	// the blocks, kept by arena_reset()
+	arena_block_t *cur;		// the block in use
+	size_t	block_size;
+	} arena_t;
+
 char *stradd(char *str, const char *source);
 
 // pascaloids
@@ -70,6 +85,17 @@ int res_match(const char *pattern, const char *source);
 int rex_match(regex_t *r, const char *source);
 int res_replace(const char *pattern, char *source, const char *repl, size_t max_matches);
 int rex_replace(regex_t *r, char *source, const char *repl, size_t max_matches);
+size_t rex_subst(regex_t *r, const char *source, const char *repl, size_t max_matches, char **dest, size_t *size);
+
+// shell
+char *shell_quote(char *dest, const char *source);
+
+// arena
+arena_t *arena_create(size_t block_size);
+void *arena_alloc(arena_t *a, size_t size);
+char *arena_strdup(arena_t *a, const char *source);
+void arena_reset(arena_t *a);
+void arena_destroy(arena_t *a);
 
 // parsing
 const char *parse_num(const char *src, char *buf);